@@ -137,6 +137,21 @@ void FileLogger::open_log_client (string log_filename, bool imediate_sync)
                                       imediate_sync ? 0 : this->sync_wait));
     shared_ptr<TProtocol> log_protocol (new TBinaryProtocol (log_transport));
     log_client = shared_ptr<EventLogClient> (new EventLogClient (log_protocol));
+
+    Guard g(position_mutex);
+    current_log_filename = log_filename;
+}
+
+string FileLogger::get_log_position ()
+{
+    // same format the replayers keep in put_log_position
+    char buf[512];
+
+    Guard g(position_mutex);
+    sprintf (buf, "%s:%ld", current_log_filename.c_str (),
+             (long)this->create_event ("").timestamp);
+
+    return buf;
 }
 
 
@@ -34,12 +34,17 @@ class FileLogger
         void send_log (std::string raw_message);
         void roll_log ();
 
+        // "<log file>:<now>", replaying from it skips everything logged so far
+        std::string get_log_position ();
+
     private:
         // this will be used to write to the log file
         boost::shared_ptr<ThruFileWriterTransport> log_transport;
         boost::shared_ptr<EventLogClient> log_client;
 
         apache::thrift::concurrency::Mutex log_mutex;
+        apache::thrift::concurrency::Mutex position_mutex;
+        std::string current_log_filename;
         std::string log_directory;
         std::string log_prefix;
         boost::filesystem::fstream index_file;
@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2007- T Jake Luciani
+ * Distributed under the New BSD Software License
+ *
+ * See accompanying file LICENSE or visit the Thrudb site at:
+ * http://thrudb.googlecode.com
+ *
+ **/
+
+#include "Utf8.h"
+
+#include <climits>
+#include <cstring>
+#include <cwchar>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+//linux and friends, windows has UTF-16 wchar_t
+#if WCHAR_MAX > 0xFFFF
+#define WCHAR_IS_UCS4 1
+#endif
+
+
+void utf8_to_wchar(const char *str, size_t len, wstring &out)
+{
+    //a NUL ends the string, same as mbrtowc
+    const void *nul = memchr(str, 0, len);
+    if(nul != NULL)
+        len = (const char *)nul - str;
+
+    //never more chars than bytes, even with surrogate pairs
+    out.resize(len);
+
+    if(len == 0)
+        return;
+
+    const unsigned char *s    = (const unsigned char *)str;
+    wchar_t             *base = &out[0];
+    wchar_t             *o    = base;
+    size_t               i    = 0;
+
+    while(i < len){
+
+        //ASCII runs
+#ifdef __SSE2__
+        while(i + 16 <= len){
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+            if(_mm_movemask_epi8(v) != 0)
+                break;
+
+            __m128i zero = _mm_setzero_si128();
+            __m128i lo   = _mm_unpacklo_epi8(v, zero);
+            __m128i hi   = _mm_unpackhi_epi8(v, zero);
+
+#ifdef WCHAR_IS_UCS4
+            _mm_storeu_si128((__m128i *)(o),      _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(o + 4),  _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(o + 8),  _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i *)(o + 12), _mm_unpackhi_epi16(hi, zero));
+#else
+            _mm_storeu_si128((__m128i *)(o),      lo);
+            _mm_storeu_si128((__m128i *)(o + 8),  hi);
+#endif
+            i += 16;
+            o += 16;
+        }
+#else
+        while(i + 8 <= len){
+            uint64_t w;
+            memcpy(&w, s + i, sizeof(w));
+
+            if(w & 0x8080808080808080ULL)
+                break;
+
+            for(int k=0; k<8; k++)
+                o[k] = s[i+k];
+
+            i += 8;
+            o += 8;
+        }
+#endif
+
+        if(i >= len)
+            break;
+
+        uint32_t c = s[i];
+
+        if(c < 0x80){
+            *o++ = (wchar_t)c;
+            i++;
+            continue;
+        }
+
+        size_t   n;
+        uint32_t cp;
+        uint32_t min;
+
+        if((c & 0xE0) == 0xC0){
+            n = 2; cp = c & 0x1F; min = 0x80;
+        } else if((c & 0xF0) == 0xE0){
+            n = 3; cp = c & 0x0F; min = 0x800;
+        } else if((c & 0xF8) == 0xF0){
+            n = 4; cp = c & 0x07; min = 0x10000;
+        } else {
+            //stray continuation byte or garbage
+            i++;
+            continue;
+        }
+
+        size_t k = 1;
+
+        if(i + n <= len){
+            for(; k<n; k++){
+                uint32_t b = s[i+k];
+
+                if((b & 0xC0) != 0x80)
+                    break;
+
+                cp = (cp << 6) | (b & 0x3F);
+            }
+        }
+
+        //truncated, overlong, surrogate or out of range
+        if(k < n || cp < min || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF){
+            i++;
+            continue;
+        }
+
+#ifndef WCHAR_IS_UCS4
+        if(cp > 0xFFFF){
+            cp  -= 0x10000;
+            *o++ = (wchar_t)(0xD800 + (cp >> 10));
+            *o++ = (wchar_t)(0xDC00 + (cp & 0x3FF));
+            i   += n;
+            continue;
+        }
+#endif
+
+        *o++ = (wchar_t)cp;
+        i   += n;
+    }
+
+    out.resize(o - base);
+}
+
+//exact number of bytes wchar_to_utf8 writes for str
+static size_t utf8_length(const wchar_t *str, size_t len)
+{
+    size_t n = 0;
+
+    for(size_t i=0; i<len; i++){
+        uint32_t c = (uint32_t)str[i];
+
+#ifndef WCHAR_IS_UCS4
+        if(c >= 0xD800 && c <= 0xDBFF && i + 1 < len &&
+           (uint32_t)str[i+1] >= 0xDC00 && (uint32_t)str[i+1] <= 0xDFFF){
+            n += 4;
+            i++;
+            continue;
+        }
+#endif
+
+        if(c < 0x80)
+            n += 1;
+        else if(c < 0x800)
+            n += 2;
+        else if(c >= 0xD800 && c <= 0xDFFF)
+            continue;
+        else if(c < 0x10000)
+            n += 3;
+        else if(c <= 0x10FFFF)
+            n += 4;
+    }
+
+    return n;
+}
+
+void wchar_to_utf8(const wchar_t *str, size_t len, string &out)
+{
+    //assume ASCII, the first char that isn't sizes the rest exactly
+    out.resize(len);
+
+    if(len == 0)
+        return;
+
+    char   *base  = &out[0];
+    char   *o     = base;
+    size_t  i     = 0;
+    bool    sized = false;
+
+    while(i < len){
+
+#ifdef __SSE2__
+        while(i + 16 <= len){
+            __m128i zero = _mm_setzero_si128();
+
+#ifdef WCHAR_IS_UCS4
+            __m128i a = _mm_loadu_si128((const __m128i *)(str + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(str + i + 4));
+            __m128i c = _mm_loadu_si128((const __m128i *)(str + i + 8));
+            __m128i d = _mm_loadu_si128((const __m128i *)(str + i + 12));
+
+            __m128i any  = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+            __m128i high = _mm_and_si128(any, _mm_set1_epi32(~0x7F));
+
+            if(_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF)
+                break;
+
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+#else
+            __m128i a = _mm_loadu_si128((const __m128i *)(str + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(str + i + 8));
+
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(~0x7F));
+
+            if(_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF)
+                break;
+
+            __m128i packed = _mm_packus_epi16(a, b);
+#endif
+            _mm_storeu_si128((__m128i *)o, packed);
+
+            i += 16;
+            o += 16;
+        }
+#endif
+
+        if(i >= len)
+            break;
+
+        uint32_t c = (uint32_t)str[i];
+
+        if(c < 0x80){
+            *o++ = (char)c;
+            i++;
+            continue;
+        }
+
+        if(!sized){
+            size_t done = o - base;
+
+            out.resize(done + utf8_length(str + i, len - i));
+
+            base  = &out[0];
+            o     = base + done;
+            sized = true;
+        }
+
+#ifndef WCHAR_IS_UCS4
+        if(c >= 0xD800 && c <= 0xDBFF && i + 1 < len &&
+           (uint32_t)str[i+1] >= 0xDC00 && (uint32_t)str[i+1] <= 0xDFFF){
+            c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)str[i+1] - 0xDC00);
+            i++;
+        }
+#endif
+
+        if(c < 0x800){
+            *o++ = (char)(0xC0 | (c >> 6));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        } else if(c >= 0xD800 && c <= 0xDFFF){
+            //lone surrogate, can't be encoded
+        } else if(c < 0x10000){
+            *o++ = (char)(0xE0 | (c >> 12));
+            *o++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        } else if(c <= 0x10FFFF){
+            *o++ = (char)(0xF0 | (c >> 18));
+            *o++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *o++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        }
+
+        i++;
+    }
+
+    out.resize(o - base);
+}
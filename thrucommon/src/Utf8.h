@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) 2007- T Jake Luciani
+ * Distributed under the New BSD Software License
+ *
+ * See accompanying file LICENSE or visit the Thrudb site at:
+ * http://thrudb.googlecode.com
+ *
+ **/
+
+#ifndef _THRUCOMMON_UTF8_H_
+#define _THRUCOMMON_UTF8_H_
+
+#include <string>
+#include <cstddef>
+
+/**
+ *UTF-8 <-> wchar_t conversion that doesn't depend on the C locale.
+ *
+ *Runs of ASCII are copied 16 chars at a time (SSE2) or 8 at a time
+ *elsewhere. Both functions replace the contents of out and reuse its
+ *capacity, so callers converting many strings should keep one buffer.
+ *
+ *Invalid or unencodable input is skipped, decoding stops at a NUL byte.
+ **/
+void utf8_to_wchar(const char *str, size_t len, std::wstring &out);
+
+void wchar_to_utf8(const wchar_t *str, size_t len, std::string &out);
+
+#endif /* _THRUCOMMON_UTF8_H_ */
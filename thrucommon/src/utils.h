@@ -18,6 +18,10 @@
 #include <uuid/uuid.h>
 #include <openssl/md5.h>
 #include <cstring>
+#include <climits>
+#include <cwchar>
+
+#include "Utf8.h"
 
 inline bool file_exists( std::string filename )
 {
@@ -128,38 +132,39 @@ inline std::string generateMD5( const std::string &id ){
 }
 
 
+//UTF-8 to wide, out is overwritten so a caller can reuse its buffer
+inline void build_wstring( const std::string &str, std::wstring &out )
+{
+    utf8_to_wchar(str.data(), str.size(), out);
+}
+
 inline std::wstring build_wstring( const std::string &str )
 {
     std::wstring wtmp;
 
-    wchar_t    tmp_wchar;
-    int        nchar;
-    mbstate_t  ps;
-    const char *c_str = str.c_str();
-    size_t size       = str.size();
+    build_wstring(str, wtmp);
 
-    memset(&ps, 0, sizeof(ps));
-    wtmp = L"";
+    return wtmp;
+}
 
-    while (c_str && size) {
-        nchar = mbrtowc(&tmp_wchar, c_str, size, &ps);
+//inverse of build_wstring, no length limit
+inline void build_string( const wchar_t *wstr, std::string &out )
+{
+    if (wstr == NULL) {
+        out.clear();
+        return;
+    }
 
-        if (nchar == -1) {
-            c_str++;
-            size--;
-            continue;
-        }
+    wchar_to_utf8(wstr, wcslen(wstr), out);
+}
 
-        //signals end of str
-        if (nchar == 0)
-            break;
+inline std::string build_string( const wchar_t *wstr )
+{
+    std::string tmp;
 
-        wtmp    += tmp_wchar;
-        c_str   += nchar;
-        size    -= nchar;
-    }
+    build_string(wstr, tmp);
 
-    return wtmp;
+    return tmp;
 }
 
 inline void wtrim(std::wstring &s){
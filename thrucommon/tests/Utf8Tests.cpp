@@ -0,0 +1,381 @@
+#ifdef HAVE_CONFIG_H
+#include "thrucommon_config.h"
+#endif
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include <stdio.h>
+
+#if HAVE_CPPUNIT
+
+#include "utils.h"
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <climits>
+#include <clocale>
+#include <cstdlib>
+#include <cwchar>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+using namespace log4cxx;
+
+//UTF-16 wchar_t (windows) stores code points past 0xFFFF as surrogate pairs
+#if WCHAR_MAX > 0xFFFF
+#define WCHAR_IS_UCS4 1
+#endif
+
+
+//build_wstring/build_string as they were, on top of the C locale
+static wstring locale_wstring(const string &str)
+{
+    wstring     wtmp;
+    wchar_t     tmp_wchar;
+    int         nchar;
+    mbstate_t   ps;
+    const char *c_str = str.c_str();
+    size_t      size  = str.size();
+
+    memset(&ps, 0, sizeof(ps));
+
+    while (c_str && size) {
+        nchar = mbrtowc(&tmp_wchar, c_str, size, &ps);
+
+        if (nchar == -1) {
+            c_str++;
+            size--;
+            continue;
+        }
+
+        if (nchar == 0)
+            break;
+
+        wtmp  += tmp_wchar;
+        c_str += nchar;
+        size  -= nchar;
+    }
+
+    return wtmp;
+}
+
+static string locale_string(const wchar_t *wstr)
+{
+    string    tmp;
+    char      buf[MB_LEN_MAX];
+    size_t    nchar;
+    mbstate_t ps;
+
+    memset(&ps, 0, sizeof(ps));
+
+    while (wstr && *wstr) {
+        nchar = wcrtomb(buf, *wstr, &ps);
+
+        if (nchar != (size_t)-1)
+            tmp.append(buf, nchar);
+
+        wstr++;
+    }
+
+    return tmp;
+}
+
+//a string of n ASCII chars, so runs end at every offset of a 8 or 16 char block
+static string ascii(size_t n)
+{
+    string s;
+
+    for(size_t i=0; i<n; i++)
+        s += (char)('a' + i % 26);
+
+    return s;
+}
+
+static wstring wide(const string &ascii)
+{
+    return wstring(ascii.begin(), ascii.end());
+}
+
+
+class Utf8Tests : public CppUnit::TestFixture
+{
+public:
+    CPPUNIT_TEST_SUITE (Utf8Tests);
+    CPPUNIT_TEST (testAsciiRuns);
+    CPPUNIT_TEST (testMultibyteAtEveryOffset);
+    CPPUNIT_TEST (testSequenceLengths);
+    CPPUNIT_TEST (testSurrogates);
+    CPPUNIT_TEST (testInvalidSkipped);
+    CPPUNIT_TEST (testOverlongSkipped);
+    CPPUNIT_TEST (testEmbeddedNul);
+    CPPUNIT_TEST (testBufferReused);
+    CPPUNIT_TEST (testMatchesLocale);
+    CPPUNIT_TEST_SUITE_END ();
+
+    void testAsciiRuns ()
+    {
+        for(size_t n=0; n<=40; n++){
+            string  s = ascii(n);
+            wstring w = build_wstring(s);
+
+            CPPUNIT_ASSERT_MESSAGE (s, w == wide(s));
+            CPPUNIT_ASSERT_EQUAL (s, build_string(w.c_str()));
+        }
+    };
+
+    //a two byte char ends the fast path at each position of a run
+    void testMultibyteAtEveryOffset ()
+    {
+        for(size_t n=0; n<=40; n++){
+            for(size_t p=0; p<=n; p++){
+                string  s = ascii(n);
+                wstring w = wide(s);
+
+                s.insert(p, "\xC3\xA9");
+                w.insert(p, 1, (wchar_t)0xE9);
+
+                CPPUNIT_ASSERT_MESSAGE (s, build_wstring(s) == w);
+                CPPUNIT_ASSERT_EQUAL (s, build_string(w.c_str()));
+            }
+        }
+    };
+
+    void testSequenceLengths ()
+    {
+        //U+00E9, U+20AC, U+1F600
+        string s = "\xC3\xA9" "\xE2\x82\xAC" "\xF0\x9F\x98\x80";
+
+        wstring w;
+        w += (wchar_t)0xE9;
+        w += (wchar_t)0x20AC;
+#ifdef WCHAR_IS_UCS4
+        w += (wchar_t)0x1F600;
+#else
+        w += (wchar_t)0xD83D;
+        w += (wchar_t)0xDE00;
+#endif
+
+        CPPUNIT_ASSERT (build_wstring(s) == w);
+        CPPUNIT_ASSERT_EQUAL (s, build_string(w.c_str()));
+
+        //the largest code point, then one past it
+#ifdef WCHAR_IS_UCS4
+        CPPUNIT_ASSERT (build_wstring("\xF4\x8F\xBF\xBF") == wstring(1, (wchar_t)0x10FFFF));
+#else
+        CPPUNIT_ASSERT_EQUAL ((size_t)2, build_wstring("\xF4\x8F\xBF\xBF").size());
+#endif
+        CPPUNIT_ASSERT (build_wstring("\xF4\x90\x80\x80").empty());
+
+        //four byte chars in a long ASCII run
+        string  run  = ascii(15) + "\xF0\x9F\x98\x80" + ascii(17);
+        wstring wrun = build_wstring(run);
+
+        CPPUNIT_ASSERT_EQUAL (run, build_string(wrun.c_str()));
+    };
+
+    void testSurrogates ()
+    {
+        //a pair is one char on UTF-16, two lone surrogates on UCS4
+        wstring pair;
+        pair += L'a';
+        pair += (wchar_t)0xD83D;
+        pair += (wchar_t)0xDE00;
+        pair += L'b';
+
+#ifdef WCHAR_IS_UCS4
+        CPPUNIT_ASSERT_EQUAL (string("ab"), build_string(pair.c_str()));
+#else
+        CPPUNIT_ASSERT_EQUAL (string("a\xF0\x9F\x98\x80" "b"), build_string(pair.c_str()));
+#endif
+
+        //lone surrogates can't be encoded
+        wstring lone;
+        lone += (wchar_t)0xDC00;
+        lone += L'a';
+        lone += (wchar_t)0xD800;
+        lone += L'b';
+        lone += (wchar_t)0xD800;
+
+        CPPUNIT_ASSERT_EQUAL (string("ab"), build_string(lone.c_str()));
+
+        //nor decoded
+        CPPUNIT_ASSERT (build_wstring("a\xED\xA0\x80" "b") == L"ab");
+        CPPUNIT_ASSERT (build_wstring("a\xED\xB0\x80" "b") == L"ab");
+    };
+
+    void testInvalidSkipped ()
+    {
+        CPPUNIT_ASSERT (build_wstring("a\xFF" "b") == L"ab");
+        CPPUNIT_ASSERT (build_wstring("\x80" "a\xBF") == L"a");
+
+        //a lead byte that isn't followed through
+        CPPUNIT_ASSERT (build_wstring("\xC3" "a") == L"a");
+        CPPUNIT_ASSERT (build_wstring("\xE2\x82" "a") == L"a");
+        CPPUNIT_ASSERT (build_wstring("ab\xE2\x82") == L"ab");
+        CPPUNIT_ASSERT (build_wstring("ab\xF0\x9F\x98") == L"ab");
+
+        //in the middle of runs either side of a block
+        for(size_t n=0; n<=40; n++){
+            string s = ascii(n);
+
+            s.insert(n / 2, "\xFE");
+
+            CPPUNIT_ASSERT_MESSAGE (s, build_wstring(s) == wide(ascii(n)));
+        }
+
+#ifdef WCHAR_IS_UCS4
+        //past U+10FFFF
+        wstring big;
+        big += L'a';
+        big += (wchar_t)0x110000;
+        big += L'b';
+
+        CPPUNIT_ASSERT_EQUAL (string("ab"), build_string(big.c_str()));
+#endif
+    };
+
+    void testOverlongSkipped ()
+    {
+        //'/' in two, three and four bytes
+        CPPUNIT_ASSERT (build_wstring("a\xC0\xAF" "b") == L"ab");
+        CPPUNIT_ASSERT (build_wstring("a\xE0\x80\xAF" "b") == L"ab");
+        CPPUNIT_ASSERT (build_wstring("a\xF0\x80\x80\xAF" "b") == L"ab");
+
+        //U+07FF in three bytes, U+FFFF in four
+        CPPUNIT_ASSERT (build_wstring("\xE0\x9F\xBF").empty());
+        CPPUNIT_ASSERT (build_wstring("\xF0\x8F\xBF\xBF").empty());
+    };
+
+    void testEmbeddedNul ()
+    {
+        CPPUNIT_ASSERT (build_wstring(string("ab\0cd", 5)) == L"ab");
+        CPPUNIT_ASSERT (build_wstring(string("\0ab", 3)).empty());
+
+        //past the first block
+        string s = ascii(20);
+        s += '\0';
+        s += ascii(20);
+
+        CPPUNIT_ASSERT (build_wstring(s) == wide(ascii(20)));
+
+        //wide strings end at their NUL
+        wstring w = wide(ascii(20));
+        w += L'\0';
+        w += L"more";
+
+        CPPUNIT_ASSERT_EQUAL (ascii(20), build_string(w.c_str()));
+        CPPUNIT_ASSERT_EQUAL (string(""), build_string((const wchar_t *)NULL));
+    };
+
+    void testBufferReused ()
+    {
+        wstring w = wide(ascii(40));
+        build_wstring("\xC3\xA9" "a", w);
+
+        wstring expect;
+        expect += (wchar_t)0xE9;
+        expect += L'a';
+
+        CPPUNIT_ASSERT (w == expect);
+
+        string s = ascii(40);
+        build_string(expect.c_str(), s);
+
+        CPPUNIT_ASSERT_EQUAL (string("\xC3\xA9" "a"), s);
+    };
+
+    //same answers as the mbrtowc/wcrtomb versions under a UTF-8 locale
+    void testMatchesLocale ()
+    {
+        if(setlocale(LC_CTYPE, "en_US.UTF-8") == NULL && setlocale(LC_CTYPE, "C.UTF-8") == NULL){
+            fprintf(stderr, "no UTF-8 locale, skipping testMatchesLocale\n");
+            return;
+        }
+
+        srand(1977);
+
+        //code points from each sequence length, no surrogates
+        uint32_t lo[] = {0x20, 0x80,  0x800,  0xE000, 0x10000};
+        uint32_t hi[] = {0x7F, 0x7FF, 0xD7FF, 0xFFFD, 0x10FFFF};
+
+        for(int i=0; i<500; i++){
+            wstring w;
+            size_t  n = rand() % 50;
+
+            for(size_t j=0; j<n; j++){
+                int      r  = rand() % 8;
+                int      k  = r < 4 ? 0 : r - 3;
+                uint32_t cp = lo[k] + rand() % (hi[k] - lo[k] + 1);
+
+#ifndef WCHAR_IS_UCS4
+                if(cp > 0xFFFF)
+                    cp = 0xFFFD;
+#endif
+                w += (wchar_t)cp;
+            }
+
+            string s = locale_string(w.c_str());
+
+            CPPUNIT_ASSERT_EQUAL (s, build_string(w.c_str()));
+            CPPUNIT_ASSERT (locale_wstring(s) == build_wstring(s));
+
+            //a bad byte somewhere, the old loop skips it the same way
+            if(!s.empty()){
+                string bad = s;
+                bad.insert(rand() % s.size(), "\xFF");
+
+                CPPUNIT_ASSERT (locale_wstring(bad) == build_wstring(bad));
+            }
+        }
+
+        //the invalid cases above, except truncation at the end which
+        //mbrtowc reports as incomplete rather than invalid, and code points
+        //past U+10FFFF which glibc decodes but can't be valid UTF-8
+        const char *invalid[] = {"a\xC0\xAF" "b", "a\xE0\x80\xAF" "b", "a\xED\xA0\x80" "b",
+                                 "\xC3" "a", "\x80" "a\xBF", NULL};
+
+        for(int i=0; invalid[i] != NULL; i++)
+            CPPUNIT_ASSERT_MESSAGE (invalid[i], locale_wstring(invalid[i]) == build_wstring(invalid[i]));
+
+        setlocale(LC_CTYPE, "C");
+    };
+};
+
+// Registers the fixture into the 'registry'
+CPPUNIT_TEST_SUITE_REGISTRATION (Utf8Tests);
+
+int main (int /* argc */, char*[] /* argv */)
+{
+    // init log
+    PropertyConfigurator::configure ("test.conf");
+
+    // Get the top level suite from the registry
+    CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry ().makeTest ();
+
+    // Adds the test to the list of test to run
+    CppUnit::TextUi::TestRunner runner;
+    runner.addTest (suite);
+
+    // Change the default outputter to a compiler error format outputter
+    runner.setOutputter (new CppUnit::CompilerOutputter (&runner.result (),
+                                                         std::cerr));
+    // Run the tests.
+    bool wasSucessful = runner.run ();
+
+    // Return error code 1 if the one of test failed.
+    return wasSucessful ? 0 : 1;
+}
+
+#else
+
+int main (int /* argc */, char*[] /* argv */)
+{
+    fprintf (stderr, "cppunit support not avaiable\n");
+    return -1;
+}
+
+#endif /* HAVE_CPPUNIT */
@@ -0,0 +1,64 @@
+#!/usr/bin/perl
+
+#
+# Copyright (c) 2007- T Jake Luciani
+# Distributed under the New BSD Software License
+#
+# See accompanying file LICENSE or visit the Thrudb site at:
+# http://thrudb.googlecode.com
+#
+#
+
+#
+# Takes a consistent copy of a running thrudex's indexes without
+# stopping writes:
+#
+#   thrudex_snapshot.pl <host> <empty dir on that host> [port]
+#
+# Index files are hard linked when the dir is on the same filesystem as
+# the index root, copied otherwise. The dir also gets thrudex.state, so a
+# server started on it with thrudex_replay picks the log up where the
+# snapshot left off. Unlike scripts/snapshot this can't race with a sync.
+#
+
+use strict;
+use warnings;
+
+use Thrift;
+use Thrift::BinaryProtocol;
+use Thrift::Socket;
+use Thrift::FramedTransport;
+
+use Thrudex::Thrudex;
+
+my $hostname = shift @ARGV;
+my $dir      = shift @ARGV;
+my $port     = shift @ARGV || 9099;
+
+die "Usage: $0 <host> <snapshot dir> [port]\n"
+    unless defined $hostname && defined $dir;
+
+eval
+{
+    my $socket    = new Thrift::Socket ($hostname, $port);
+    my $transport = new Thrift::FramedTransport ($socket);
+    my $protocol  = new Thrift::BinaryProtocol ($transport);
+    my $client    = new Thrudex::ThrudexClient ($protocol);
+
+    #a sync of every index can take a while
+    $socket->setRecvTimeout (3600 * 1000);
+
+    $transport->open ();
+
+    $client->admin ("snapshot", $dir);
+
+    $transport->close ();
+};
+if($@)
+{
+    die $@->{what}    if (UNIVERSAL::isa ($@,"Thrudex::ThrudexException"));
+    die $@->{message} if (UNIVERSAL::isa ($@,"Thrift::TException"));
+    die $@;
+}
+
+print "Snapshot written to $hostname:$dir\n";
@@ -0,0 +1,244 @@
+#ifdef HAVE_CONFIG_H
+#include "thrudex_config.h"
+#endif
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include "CLuceneAnalyzers.h"
+#include "CLuceneIndex.h"
+#include "utils.h"
+
+#include <fstream>
+#include <wctype.h>
+
+#include "ThruLogging.h"
+
+using namespace std;
+using namespace boost;
+using namespace thrudex;
+using namespace lucene::analysis;
+
+
+/**
+ *Reads the whole field up front, fields run through this are short
+ **/
+class NGramTokenStream : public TokenStream
+{
+ public:
+    NGramTokenStream(lucene::util::Reader *reader, size_t gram_size)
+        : gram_size(gram_size), pos(0), word_end(0)
+    {
+        const TCHAR *buf;
+        int32_t      n;
+
+        while((n = reader->read(buf, LUCENE_IO_BUFFER_SIZE)) > 0)
+            text.append(buf, n);
+
+        for(size_t i=0; i<text.size(); i++)
+            text[i] = towlower(text[i]);
+    }
+
+    bool next(Token *token)
+    {
+        while(true){
+
+            if(pos < word_end){
+                size_t len = word_end - pos < gram_size ? word_end - pos : gram_size;
+
+                gram.assign(text, pos, len);
+                token->set(gram.c_str(), pos, pos + len);
+
+                //a short word is a single gram
+                if(pos + gram_size >= word_end)
+                    pos = word_end;
+                else
+                    pos++;
+
+                return true;
+            }
+
+            pos = word_end;
+
+            while(pos < text.size() && iswspace(text[pos]))
+                pos++;
+
+            if(pos >= text.size())
+                return false;
+
+            word_end = pos;
+
+            while(word_end < text.size() && !iswspace(text[word_end]))
+                word_end++;
+        }
+    }
+
+    void close()
+    {
+
+    }
+
+ private:
+    size_t       gram_size;
+    std::wstring text;
+    std::wstring gram;
+    size_t       pos;       ///< start of the next gram
+    size_t       word_end;
+};
+
+NGramAnalyzer::NGramAnalyzer(int32_t gram_size)
+    : gram_size(gram_size > 0 ? gram_size : 1)
+{
+
+}
+
+TokenStream* NGramAnalyzer::tokenStream(const TCHAR *field_name, lucene::util::Reader *reader)
+{
+    return new NGramTokenStream(reader, gram_size);
+}
+
+
+static bool valid_analyzer(const string &name)
+{
+    return name == "standard" || name == "whitespace" || name == "keyword" || name == "ngram";
+}
+
+AnalyzerConfig::AnalyzerConfig(const string &index_name)
+    : index_name(index_name)
+{
+    analyzer = read_index_config<string>(index_name, "ANALYZER", "standard");
+}
+
+void AnalyzerConfig::parse(const string &option)
+{
+    string::size_type eq = option.find('=');
+
+    ThrudexException ex;
+
+    if(eq == string::npos){
+        ex.what = "Invalid index option: "+option;
+        throw ex;
+    }
+
+    string key   = option.substr(0, eq);
+    string value = option.substr(eq+1);
+
+    if(!valid_analyzer(value)){
+        ex.what = "Unknown analyzer: "+value;
+        throw ex;
+    }
+
+    if(key == "analyzer"){
+        analyzer = value;
+        return;
+    }
+
+    if(key.substr(0,6) != "field." || key.size() == 6){
+        ex.what = "Invalid index option: "+option;
+        throw ex;
+    }
+
+    string field = key.substr(6);
+
+    //has to survive the meta file
+    if(field.find_first_of(",:=# \t\r\n") != string::npos){
+        ex.what = "Field name contains illegal chars: "+field;
+        throw ex;
+    }
+
+    fields[field] = value;
+}
+
+void AnalyzerConfig::load(const string &meta_file)
+{
+    ConfigFile meta(meta_file);
+
+    analyzer = meta.read<string>("analyzer", analyzer);
+
+    //sku:ngram,title:whitespace
+    string field_list = meta.read<string>("fields", "");
+
+    vector<string> pairs = split(field_list, ",");
+
+    for(size_t i=0; i<pairs.size(); i++){
+        string::size_type colon = pairs[i].find(':');
+
+        if(colon == string::npos)
+            continue;
+
+        string value = pairs[i].substr(colon+1);
+
+        if(!valid_analyzer(value)){
+            T_ERROR("%s: unknown analyzer %s in %s",index_name.c_str(),value.c_str(),meta_file.c_str());
+            continue;
+        }
+
+        fields[pairs[i].substr(0,colon)] = value;
+    }
+
+    if(!valid_analyzer(analyzer)){
+        T_ERROR("%s: unknown analyzer %s in %s, using standard",index_name.c_str(),analyzer.c_str(),meta_file.c_str());
+        analyzer = "standard";
+    }
+}
+
+void AnalyzerConfig::save(const string &meta_file) const
+{
+    string field_list;
+
+    for(map<string,string>::const_iterator it=fields.begin(); it!=fields.end(); ++it){
+        if(!field_list.empty())
+            field_list += ",";
+
+        field_list += it->first+":"+it->second;
+    }
+
+    ofstream out(meta_file.c_str(), ios::out | ios::trunc);
+
+    if(!out.is_open()){
+        ThrudexException ex;
+        ex.what = "Can't write "+meta_file;
+        throw ex;
+    }
+
+    out << "analyzer = " << analyzer   << endl;
+    out << "fields = "   << field_list << endl;
+
+    if(!out.good()){
+        ThrudexException ex;
+        ex.what = "Can't write "+meta_file;
+        throw ex;
+    }
+}
+
+bool AnalyzerConfig::isDefault() const
+{
+    return analyzer == "standard" && fields.empty();
+}
+
+Analyzer *AnalyzerConfig::create(const string &name) const
+{
+    if(name == "whitespace")
+        return new WhitespaceAnalyzer();
+
+    if(name == "keyword")
+        return new KeywordAnalyzer();
+
+    if(name == "ngram")
+        return new NGramAnalyzer(read_index_config<int32_t>(index_name, "NGRAM_SIZE", 3));
+
+    return new standard::StandardAnalyzer();
+}
+
+shared_ptr<Analyzer> AnalyzerConfig::build() const
+{
+    if(fields.empty())
+        return shared_ptr<Analyzer>(this->create(analyzer));
+
+    //the wrapper owns the analyzers it is given
+    shared_ptr<PerFieldAnalyzerWrapper> wrapper(new PerFieldAnalyzerWrapper(this->create(analyzer)));
+
+    for(map<string,string>::const_iterator it=fields.begin(); it!=fields.end(); ++it)
+        wrapper->addAnalyzer(build_wstring(it->first).c_str(), this->create(it->second));
+
+    return wrapper;
+}
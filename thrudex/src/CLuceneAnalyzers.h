@@ -0,0 +1,61 @@
+#ifndef __CLUCENE_ANALYZERS_H__
+#define __CLUCENE_ANALYZERS_H__
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+
+#include <CLucene.h>
+
+/**
+ *Splits each whitespace separated word into lower cased n-grams of a
+ *single size, words shorter than that are kept whole. Grams get
+ *consecutive positions so a phrase of them matches any part of a word,
+ *which is what part numbers and SKUs want.
+ **/
+class NGramAnalyzer : public lucene::analysis::Analyzer
+{
+ public:
+    NGramAnalyzer(int32_t gram_size);
+
+    lucene::analysis::TokenStream* tokenStream(const TCHAR *field_name, lucene::util::Reader *reader);
+
+ private:
+    int32_t gram_size;
+};
+
+/**
+ *Which analyzer an index, and optionally each of its fields, uses.
+ *
+ *Chosen at create_index time ("name|analyzer=keyword|field.sku=ngram")
+ *and kept in <idx_root>/<name>.meta. Indexes without one use the ANALYZER
+ *setting (default standard). Valid analyzers are standard, whitespace,
+ *keyword and ngram (NGRAM_SIZE, default 3).
+ **/
+class AnalyzerConfig
+{
+ public:
+    AnalyzerConfig(const std::string &index_name);
+
+    //"analyzer=<name>" or "field.<field>=<name>", throws ThrudexException
+    void parse(const std::string &option);
+
+    void load(const std::string &meta_file);
+    void save(const std::string &meta_file) const;
+
+    //plain StandardAnalyzer for every field
+    bool isDefault() const;
+
+    boost::shared_ptr<lucene::analysis::Analyzer> build() const;
+
+ private:
+    lucene::analysis::Analyzer *create(const std::string &name) const;
+
+    const std::string                   index_name;
+
+    std::string                         analyzer;
+    std::map<std::string, std::string>  fields;
+};
+
+#endif
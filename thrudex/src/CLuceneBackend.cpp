@@ -7,9 +7,14 @@
 #include "CLuceneBackend.h"
 #include "ConfigFile.h"
 #include "utils.h"
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <concurrency/Util.h>
+#include <concurrency/Exception.h>
+#include <concurrency/PosixThreadFactory.h>
+
+#include <unistd.h>
 
 namespace fs = boost::filesystem;
 using namespace boost;
@@ -17,6 +22,43 @@ using namespace apache::thrift::concurrency;
 
 using namespace thrudex;
 
+/**
+ *Opens an index on the load pool
+ **/
+class IndexLoader : public Runnable
+{
+ public:
+    IndexLoader(CLuceneBackend *backend, const string &index)
+        : backend(backend), index(index) {};
+
+    void run()
+    {
+        backend->loadIndex(index);
+    }
+
+ private:
+    CLuceneBackend *backend;
+    const string    index;
+};
+
+/**
+ *Optimizes and builds the bloom filter of an open index on the load pool
+ **/
+class IndexWarmer : public Runnable
+{
+ public:
+    IndexWarmer(shared_ptr<CLuceneShardedIndex> index)
+        : index(index) {};
+
+    void run()
+    {
+        index->warmup();
+    }
+
+ private:
+    shared_ptr<CLuceneShardedIndex> index;
+};
+
 CLuceneBackend::CLuceneBackend(const string &idx_root)
     : idx_root(idx_root)
 {
@@ -28,6 +70,14 @@ CLuceneBackend::CLuceneBackend(const string &idx_root)
 
     analyzer = boost::shared_ptr<lucene::analysis::Analyzer>(new lucene::analysis::standard::StandardAnalyzer());
 
+    load_wait = ConfigManager->read<int>("INDEX_LOAD_WAIT_MS",0);
+
+    bulk_min_docs = ConfigManager->read<int>("BULK_PUT_MIN_DOCS",100);
+
+    load_pool = ThreadManager::newSimpleThreadManager(ConfigManager->read<int>("INDEX_LOAD_THREADS",4));
+    load_pool->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+    load_pool->start();
+
     //grab the list of current indices
     boost::filesystem::directory_iterator end;
 
@@ -39,9 +89,14 @@ CLuceneBackend::CLuceneBackend(const string &idx_root)
             if(i->path().leaf().substr(0,1) == ".")
                 continue;
 
-            this->addIndex( i->path().leaf() );
+            {
+                Synchronized s(load_monitor);
+                loading.insert( i->path().leaf() );
+            }
+
+            load_pool->add( shared_ptr<Runnable>(new IndexLoader(this, i->path().leaf())) );
 
-            T_DEBUG( "Added %s",i->path().leaf().c_str() );
+            T_DEBUG( "Loading %s",i->path().leaf().c_str() );
         }
     }
 }
@@ -53,11 +108,54 @@ CLuceneBackend::~CLuceneBackend()
 
 bool CLuceneBackend::isValidIndex(const string &index)
 {
+    {
+        RWGuard g(mutex);
+
+        if(index_cache.count(index))
+            return true;
+    }
+
+    Synchronized s(load_monitor);
+
+    int64_t deadline = Util::currentTime() + load_wait;
+
+    while(loading.count(index)){
+
+        int64_t remaining = deadline - Util::currentTime();
+
+        if(remaining <= 0){
+            ThrudexException ex;
+            ex.what = "Index is loading: "+index;
+
+            throw ex;
+        }
+
+        try{
+            load_monitor.wait(remaining);
+        }catch(TimedOutException &e){
+            //checked above
+        }
+    }
+
     RWGuard g(mutex);
 
     return (index_cache.count(index) ? true : false);
 }
 
+shared_ptr<CLuceneShardedIndex> CLuceneBackend::getIndex(const string &index)
+{
+    if(!this->isValidIndex( index )){
+        ThrudexException ex;
+        ex.what = "Invalid index: "+index;
+
+        throw ex;
+    }
+
+    RWGuard g(mutex);
+
+    return index_cache[index];
+}
+
 
 vector<string> CLuceneBackend::getIndices()
 {
@@ -67,7 +165,7 @@ vector<string> CLuceneBackend::getIndices()
 
     vector<string> indices;
 
-    map<string,shared_ptr<CLuceneIndex> >::iterator it;
+    map<string,shared_ptr<CLuceneShardedIndex> >::iterator it;
 
     for(it = index_cache.begin(); it != index_cache.end(); ++it){
         indices.push_back(it->first);
@@ -84,10 +182,67 @@ void CLuceneBackend::addIndex(const string &index)
     if(this->isValidIndex(index))
         return;
 
-    size_t filter_space = ConfigManager->read<int>("FILTER_SPACE_SIZE",1000000);
+    size_t filter_space = read_index_config<int>(index,"FILTER_SPACE_SIZE",1000000);
+
+    shared_ptr<lucene::analysis::Analyzer> index_analyzer = this->getAnalyzer(index);
+
+    RWGuard g(mutex, true);
+
+    if(index_cache.count(index))
+        return;
 
     index_cache[index] =
-        shared_ptr<CLuceneIndex>(new CLuceneIndex(idx_root,index,filter_space,analyzer));
+        shared_ptr<CLuceneShardedIndex>(new CLuceneShardedIndex(idx_root,index,filter_space,index_analyzer));
+}
+
+/**
+ *Analyzer recorded for the index at create time, if any
+ **/
+shared_ptr<lucene::analysis::Analyzer> CLuceneBackend::getAnalyzer(const string &index)
+{
+    AnalyzerConfig config(index);
+
+    string meta_file = idx_root + "/" + index + ".meta";
+
+    if(file_exists(meta_file))
+        config.load(meta_file);
+
+    if(config.isDefault())
+        return analyzer;
+
+    return config.build();
+}
+
+void CLuceneBackend::loadIndex(const string &index)
+{
+    T_DEBUG( "loadIndex: index=%s", index.c_str() );
+
+    size_t filter_space = read_index_config<int>(index,"FILTER_SPACE_SIZE",1000000);
+
+    shared_ptr<CLuceneShardedIndex> idx;
+
+    try{
+
+        idx = shared_ptr<CLuceneShardedIndex>(new CLuceneShardedIndex(idx_root,index,filter_space,this->getAnalyzer(index)));
+
+        RWGuard g(mutex, true);
+        index_cache[index] = idx;
+
+    }catch(ThrudexException &e){
+        T_ERROR("Failed to load index %s: %s",index.c_str(),e.what.c_str());
+    }catch(std::exception &e){
+        T_ERROR("Failed to load index %s: %s",index.c_str(),e.what());
+    }
+
+    {
+        Synchronized s(load_monitor);
+        loading.erase(index);
+        load_monitor.notifyAll();
+    }
+
+    //searchable now, optimize and bloom after every index is open
+    if(idx.get() != NULL)
+        load_pool->add( shared_ptr<Runnable>(new IndexWarmer(idx)) );
 }
 
 
@@ -95,101 +250,203 @@ void CLuceneBackend::put(const thrudex::Document &d)
 {
     T_DEBUG( "put: d.index=%s, d.key=%s", d.index.c_str(), d.key.c_str() );
 
-    if(!this->isValidIndex( d.index )){
+    shared_ptr<CLuceneShardedIndex> index = this->getIndex( d.index );
+
+    //a bad document is reported to the caller, as the bulk path does
+    shared_ptr<lucene::document::Document> doc = this->buildDocument(d);
+
+    try{
+
+        index->put( d.key, doc );
+
+    }catch(CLuceneError &e){
         ThrudexException ex;
-        ex.what = "Invalid index: "+d.index;
+        ex.what = "Error during put: '"+string(e.what())+"'";
 
         throw ex;
     }
+}
 
-    lucene::document::Document *doc = new lucene::document::Document();
+/**
+ *Converts a thrift document, throws ThrudexException if it has no key
+ **/
+shared_ptr<lucene::document::Document> CLuceneBackend::buildDocument(const thrudex::Document &d)
+{
+    shared_ptr<lucene::document::Document> doc(new lucene::document::Document());
 
-    try{
+    wstring doc_key     = build_wstring( d.key );
 
-        wstring doc_key     = build_wstring( d.key );
+    if( doc_key.empty() ){
+        ThrudexException ex;
+        ex.what = "Missing key";
 
-        if( doc_key.empty() ){
-            ThrudexException ex;
-            ex.what = "Missing key";
+        throw ex;
+    }
 
-            throw ex;
+    lucene::document::Field *f;
+
+    //add the document key
+    f = new lucene::document::Field(DOC_KEY, doc_key.c_str(), lucene::document::Field::STORE_YES | lucene::document::Field::INDEX_UNTOKENIZED);
+    doc->add(*f);
+
+    //check for payload
+    if( !d.payload.empty() ){
+      f = new lucene::document::Field(DOC_PAYLOAD, build_wstring(d.payload).c_str(), lucene::document::Field::STORE_YES | lucene::document::Field::INDEX_NO);
+      doc->add(*f);
+    }
+
+    //populate the document, Field copies the text so the buffers are reused
+    wstring key, value;
+
+    for( unsigned int j=0; j<d.fields.size(); j++){
+
+        T_DEBUG("%s:%s",d.fields[j].key.c_str(),d.fields[j].value.c_str());
+
+        build_wstring( d.fields[j].key,   key   );
+        build_wstring( d.fields[j].value, value );
+
+
+        switch(d.fields[j].type){
+            case thrudex::KEYWORD:
+                T_DEBUG("Keyword");
+                f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_UNTOKENIZED); break;
+            case thrudex::TEXT:
+                T_DEBUG("Text");
+                f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_TOKENIZED); break;
+            default:
+                T_DEBUG("UnStored");
+                f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_NO|lucene::document::Field::INDEX_TOKENIZED); break;
+        };
+
+        if(d.fields[j].weight> 0){
+            f->setBoost( d.fields[j].weight );
         }
 
-        lucene::document::Field *f;
 
-        //add the document key
-	f = new lucene::document::Field(DOC_KEY, doc_key.c_str(), lucene::document::Field::STORE_YES | lucene::document::Field::INDEX_UNTOKENIZED);
         doc->add(*f);
 
-        //check for payload
-        if( !d.payload.empty() ){
-	  f = new lucene::document::Field(DOC_PAYLOAD, build_wstring(d.payload).c_str(), lucene::document::Field::STORE_YES | lucene::document::Field::INDEX_NO);
-          doc->add(*f);
+        //If Sorted field then add _sort
+        if(d.fields[j].sortable){
+            key += L"_sort";
+
+            f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_UNTOKENIZED);
+
+            doc->add(*f);
         }
+    }
 
-        //populate the document
-        for( unsigned int j=0; j<d.fields.size(); j++){
+    if(d.weight > 0)
+        doc->setBoost(d.weight);
 
-            T_DEBUG("%s:%s",d.fields[j].key.c_str(),d.fields[j].value.c_str());
+    return doc;
+}
 
-            wstring key   = build_wstring( d.fields[j].key   );
-            wstring value = build_wstring( d.fields[j].value );
+vector<ThrudexException> CLuceneBackend::putList(const vector<thrudex::Document> &documents)
+{
+    if(bulk_min_docs <= 0 || documents.size() < (size_t)bulk_min_docs)
+        return ThrudexBackend::putList(documents);
+
+    T_DEBUG( "putList: bulk put of %d docs", (int)documents.size() );
+
+    ThrudexException         none;
+    vector<ThrudexException> exceptions(documents.size(), none);
 
+    //look each index up once
+    map<string, shared_ptr<CLuceneShardedIndex> > indexes;
+    map<string, ThrudexException>          invalid;
 
-            switch(d.fields[j].type){
-                case thrudex::KEYWORD:
-                    T_DEBUG("Keyword");
-		    f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_UNTOKENIZED); break;
-                case thrudex::TEXT:
-                    T_DEBUG("Text");
-		    f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_TOKENIZED); break;
-                default:
-                    T_DEBUG("UnStored");
-		    f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_NO|lucene::document::Field::INDEX_TOKENIZED); break;
-            };
+    for(size_t i=0; i<documents.size(); i++){
+        const string &name = documents[i].index;
 
-            if(d.fields[j].weight> 0){
-                f->setBoost( d.fields[j].weight );
+        if(indexes.count(name) == 0 && invalid.count(name) == 0){
+            try{
+                indexes[name] = this->getIndex(name);
+            }catch(ThrudexException e){
+                invalid[name] = e;
             }
+        }
+
+        if(invalid.count(name) > 0)
+            exceptions[i] = invalid[name];
+    }
 
+    //converting the fields is the cpu heavy part, do it outside the index locks
+    vector<shared_ptr<lucene::document::Document> > docs(documents.size());
 
-            doc->add(*f);
+    size_t chunk = 256;
+    size_t lanes = (documents.size() + chunk - 1) / chunk;
 
-            //If Sorted field then add _sort
-            if(d.fields[j].sortable){
-                key += L"_sort";
+    this->runBatch(lanes, boost::bind(&CLuceneBackend::buildLane, this, boost::cref(documents), boost::ref(docs),
+                                      boost::ref(exceptions), chunk, _1));
 
-		f = new lucene::document::Field(key.c_str(),value.c_str(),lucene::document::Field::STORE_YES|lucene::document::Field::INDEX_UNTOKENIZED);
+    //one batch per index, in list order
+    map<string, vector<size_t> > by_index;
 
-                doc->add(*f);
-            }
-        }
+    for(size_t i=0; i<documents.size(); i++){
+        if(docs[i].get() != NULL)
+            by_index[documents[i].index].push_back(i);
+    }
+
+    map<string, vector<size_t> >::iterator it;
+    for(it=by_index.begin(); it!=by_index.end(); ++it){
 
-        if(d.weight > 0)
-            doc->setBoost(d.weight);
+        vector<pair<string, shared_ptr<lucene::document::Document> > > batch;
+        batch.reserve(it->second.size());
 
+        for(size_t j=0; j<it->second.size(); j++)
+            batch.push_back( make_pair(documents[it->second[j]].key, docs[it->second[j]]) );
 
-        index_cache[d.index]->put( d.key, doc );
+        try{
 
-    }catch(...){
-        //
+            indexes[it->first]->putList(batch);
+
+        }catch(ThrudexException e){
+            for(size_t j=0; j<it->second.size(); j++)
+                exceptions[it->second[j]] = e;
+        }catch(std::exception &e){
+            for(size_t j=0; j<it->second.size(); j++)
+                exceptions[it->second[j]].what = e.what();
+        }catch(...){
+            for(size_t j=0; j<it->second.size(); j++)
+                exceptions[it->second[j]].what = "Unknown error during put";
+        }
     }
 
-    delete doc;
+    return exceptions;
 }
 
-void CLuceneBackend::remove(const thrudex::Element &el)
+void CLuceneBackend::buildLane(const vector<thrudex::Document> &documents,
+                               vector<shared_ptr<lucene::document::Document> > &docs,
+                               vector<ThrudexException> &exceptions, size_t chunk, size_t lane)
 {
-    T_DEBUG( "remove: el.index=%s, el.key", el.index.c_str(), el.key.c_str() );
+    size_t end = (lane+1)*chunk;
 
-    if(!this->isValidIndex( el.index )){
-        ThrudexException ex;
-        ex.what = "Invalid index: "+el.index;
+    if(end > documents.size())
+        end = documents.size();
 
-        throw ex;
+    for(size_t i=lane*chunk; i<end; i++){
+
+        //bad index
+        if(!exceptions[i].what.empty())
+            continue;
+
+        try{
+            docs[i] = this->buildDocument(documents[i]);
+        }catch(ThrudexException e){
+            exceptions[i] = e;
+        }catch(std::exception &e){
+            exceptions[i].what = e.what();
+        }catch(...){
+            exceptions[i].what = "Unknown error during put";
+        }
     }
+}
 
-    index_cache[el.index]->remove(el.key);
+void CLuceneBackend::remove(const thrudex::Element &el)
+{
+    T_DEBUG( "remove: el.index=%s, el.key", el.index.c_str(), el.key.c_str() );
+
+    this->getIndex( el.index )->remove(el.key);
 }
 
 
@@ -197,14 +454,7 @@ void CLuceneBackend::search(const thrudex::SearchQuery &q, thrudex::SearchRespon
 {
     T_DEBUG( "search: q.index=%s, q.query=%s", q.index.c_str(), q.query.c_str() );
 
-    if(!this->isValidIndex( q.index )){
-        ThrudexException ex;
-        ex.what = "Invalid index: "+q.index;
-
-        throw ex;
-    }
-
-    index_cache[q.index]->search(q,r);
+    this->getIndex( q.index )->search(q,r);
 }
 
 
@@ -216,7 +466,9 @@ string CLuceneBackend::admin(const std::string &op, const std::string &data)
 
     if(op == "create_index"){
 
-        string name = data;
+        //name|analyzer=keyword|field.sku=ngram
+        vector<string> options = split(data, "|");
+        string         name    = options[0];
 
         for(unsigned int i=0; i<name.size(); i++){
             if( !isascii(name[i]) ){
@@ -237,8 +489,36 @@ string CLuceneBackend::admin(const std::string &op, const std::string &data)
 
         }
 
+        //addIndex reads the analyzers back from the meta file
+        string meta_file;
+
+        if(options.size() > 1){
+
+            AnalyzerConfig config(name);
+
+            for(size_t i=1; i<options.size(); i++)
+                config.parse(options[i]);
+
+            if(this->isValidIndex(name)){
+                T_INFO("Index %s exists, ignoring analyzer options",name.c_str());
+                return "ok";
+            }
+
+            meta_file = idx_root + "/" + name + ".meta";
+            config.save(meta_file);
+        }
+
         T_DEBUG( "Creating index:%s",name.c_str());
-        this->addIndex(name);
+
+        try{
+            this->addIndex(name);
+        }catch(...){
+            //or a later create_index without options would pick it up
+            if(!meta_file.empty())
+                unlink(meta_file.c_str());
+
+            throw;
+        }
 
         return "ok";
     }
@@ -252,7 +532,78 @@ string CLuceneBackend::admin(const std::string &op, const std::string &data)
             throw e;
         }
 
-        index_cache[data]->optimize();
+        this->getIndex(data)->optimize();
+    }
+
+    if(op == "snapshot"){
+
+        string target = data;
+
+        if(target.empty()){
+            ThrudexException e;
+            e.what = "Missing snapshot directory";
+            throw e;
+        }
+
+        if(fs::exists(target) && !fs::is_empty(target)){
+            ThrudexException e;
+            e.what = "Snapshot directory isn't empty: "+target;
+            throw e;
+        }
+
+        {
+            Synchronized s(load_monitor);
+
+            if(!loading.empty()){
+                ThrudexException e;
+                e.what = "Indexes are still loading";
+                throw e;
+            }
+        }
+
+        fs::create_directories(target);
+
+        map<string,shared_ptr<CLuceneShardedIndex> > indexes;
+        {
+            RWGuard g(mutex);
+            indexes = index_cache;
+        }
+
+        map<string,shared_ptr<CLuceneShardedIndex> >::iterator it;
+
+        for(it = indexes.begin(); it != indexes.end(); ++it){
+
+            it->second->snapshot(target);
+
+            string meta_file = idx_root + "/" + it->first + ".meta";
+
+            if(file_exists(meta_file))
+                fs::copy_file(meta_file, target + "/" + it->first + ".meta");
+        }
+
+        //LogBackend writes the snapshot's thrudex.state, it knows the log position
+
+        return "done";
+    }
+
+    if(op == "stats"){
+
+        string stats;
+
+        RWGuard g(mutex);
+
+        map<string,shared_ptr<CLuceneShardedIndex> >::iterator it;
+
+        for(it = index_cache.begin(); it != index_cache.end(); ++it){
+
+            //optionally limit to a single index
+            if(!data.empty() && data != it->first)
+                continue;
+
+            stats += it->second->stats();
+        }
+
+        return stats;
     }
 
     if (op == "put_log_position") {
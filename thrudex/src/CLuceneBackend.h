@@ -7,16 +7,34 @@
 
 #include <concurrency/Mutex.h>
 #include <concurrency/Monitor.h>
+#include <concurrency/ThreadManager.h>
 #include <concurrency/Util.h>
 
 #include <iostream>
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 
-#include "CLuceneIndex.h"
+#include "CLuceneShardedIndex.h"
+#include "CLuceneAnalyzers.h"
 
+/**
+ *Existing indexes are opened in parallel on a small thread pool when the
+ *backend starts, then optimized and warmed up in the background.
+ *
+ *Requests for an index still being opened wait up to INDEX_LOAD_WAIT_MS
+ *(default 0, fail fast) before being rejected.
+ *
+ *putList calls of BULK_PUT_MIN_DOCS or more build their documents on the
+ *batch pool and hand each index the whole batch under one lock.
+ *
+ *create_index takes analyzer options after the name, see AnalyzerConfig.
+ *
+ *admin("snapshot", dir) syncs every index and links its files into dir,
+ *which can then be used as the idx_root of a new server.
+ **/
 class CLuceneBackend : public ThrudexBackend
 {
  public:
@@ -29,19 +47,41 @@ class CLuceneBackend : public ThrudexBackend
     void  remove(const thrudex::Element     &e);
     void  search(const thrudex::SearchQuery &s, thrudex::SearchResponse &r);
 
+    std::vector<thrudex::ThrudexException> putList(const std::vector<thrudex::Document> &documents);
+
     std::string admin(const std::string &op, const std::string &data);
 
  private:
 
+    friend class IndexLoader;
+
     void  addIndex     (const std::string &index);
+    void  loadIndex    (const std::string &index);
     bool  isValidIndex (const std::string &index);
 
+    boost::shared_ptr<CLuceneShardedIndex> getIndex(const std::string &index);
+
+    boost::shared_ptr<lucene::analysis::Analyzer> getAnalyzer(const std::string &index);
+
+    boost::shared_ptr<lucene::document::Document> buildDocument(const thrudex::Document &d);
+
+    void  buildLane    (const std::vector<thrudex::Document> &documents,
+                        std::vector<boost::shared_ptr<lucene::document::Document> > &docs,
+                        std::vector<thrudex::ThrudexException> &exceptions, size_t chunk, size_t lane);
+
     const std::string   idx_root;       ///< from conf file
 
-    std::map<std::string, boost::shared_ptr<CLuceneIndex> > index_cache;
+    std::map<std::string, boost::shared_ptr<CLuceneShardedIndex> > index_cache;
 
-    boost::shared_ptr<lucene::analysis::Analyzer> analyzer;
+    boost::shared_ptr<lucene::analysis::Analyzer> analyzer;   ///< shared by indexes using the default
     apache::thrift::concurrency::ReadWriteMutex mutex;
+
+    boost::shared_ptr<apache::thrift::concurrency::ThreadManager> load_pool;
+    apache::thrift::concurrency::Monitor load_monitor;
+    std::set<std::string>                loading;       ///< indexes being opened
+    int64_t                              load_wait;
+
+    int32_t                              bulk_min_docs;
 };
 
 #endif
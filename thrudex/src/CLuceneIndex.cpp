@@ -7,10 +7,19 @@
 #include "CLuceneIndex.h"
 #include "utils.h"
 #include <concurrency/Util.h>
+#include <concurrency/Exception.h>
 #include <concurrency/PosixThreadFactory.h>
 
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
 #include "bloom_filter.hpp"
 #include "UpdateFilter.h"
+#include "HitCollectors.h"
 #include "ThruLogging.h"
 
 
@@ -48,9 +57,24 @@ struct reader_deleter
     }
 };
 
-CLuceneIndex::CLuceneIndex(const string &index_root, const string &index_name, const size_t &filter_space, shared_ptr<Analyzer> analyzer)
-    : index_root(index_root), index_name(index_name), analyzer(analyzer), filter_space(filter_space), last_synched(0), syncing(false)
+CLuceneIndex::CLuceneIndex(const string &index_root, const string &index_name, const size_t &filter_space, shared_ptr<Analyzer> analyzer,
+                           const string &config_name, shared_ptr<Mutex> sync_lock)
+    : index_root(index_root), index_name(index_name), config_name(config_name.empty() ? index_name : config_name),
+      analyzer(analyzer), filter_space(filter_space), last_synched(0), syncing(false),
+      sync_lock(sync_lock), ram_docs(0), ram_bytes(0), first_modified(0), loaded(false), timed_out_searches(0)
 {
+    if(this->sync_lock.get() == NULL)
+        this->sync_lock.reset(new Mutex());
+
+    sync_max_ram_bytes = read_index_config<int64_t>(this->config_name, "SYNC_MAX_RAM_BYTES", 64*1024*1024);
+    sync_max_docs      = read_index_config<int32_t>(this->config_name, "SYNC_MAX_DOCS", 100000);
+    sync_max_age       = read_index_config<int64_t>(this->config_name, "SYNC_MAX_AGE_MS", 10000);
+    nrt_max_docs       = read_index_config<int32_t>(this->config_name, "NRT_MAX_BUFFERED_DOCS", 1000);
+    nrt_max_delay      = read_index_config<int64_t>(this->config_name, "NRT_MAX_DELAY_MS", 1000);
+    nrt_refresh        = read_index_config<int64_t>(this->config_name, "NRT_REFRESH_MS", NRT_REFRESH_MS_DEFAULT);
+
+    search_timeout         = read_index_config<int32_t>(this->config_name, "SEARCH_TIMEOUT_MS", 0);
+    search_timeout_partial = read_index_config<bool>(this->config_name, "SEARCH_TIMEOUT_PARTIAL", true);
 
     //Verify log dir
     if(!directory_exists( index_root )){
@@ -84,41 +108,15 @@ CLuceneIndex::CLuceneIndex(const string &index_root, const string &index_name, c
             T_DEBUG("Created index :%s",index_name.c_str());
         }
 
-        //build up bloom filter
+        //bloom filter is populated by warmup(), a new index has nothing to add
         disk_bloom    = shared_ptr<bloom_filter>(new bloom_filter(filter_space,1.0/(1.0 * filter_space), random_seed));
         disk_directory= shared_ptr<FSDirectory>(FSDirectory::getDirectory(idx_path.c_str(),false));
         this->disk_directory->__cl_addref(); //trick clucene's lame ref counters
 
-        //optimize on startup
-        this->optimize();
-
-
         disk_reader   = shared_ptr<IndexReader>(IndexReader::open( disk_directory.get(), false), reader_deleter() );
         disk_filter   = shared_ptr<UpdateFilter>(new UpdateFilter(disk_reader));
 
-        if(!new_index){
-
-            int max = disk_reader->maxDoc();
-            char buf[1024];
-
-            for(int i=0; i<max; i++){
-                try{
-
-                    if(disk_reader->isDeleted(i))
-                        continue;
-
-                    const wchar_t *id   = disk_reader->document(i)->get( DOC_KEY );
-
-                    STRCPY_TtoA(buf,id,1024);
-
-                    T_DEBUG("blooming index id: %s(%s)",index_name.c_str(),buf);
-
-                    disk_bloom->insert(buf);
-                }catch(CLuceneError &e){
-                    T_ERROR("Error while populating bloom filter: %s",e.what());
-                }
-            }
-        }
+        loaded        = new_index;
 
         ram_directory = shared_ptr<CLuceneRAMDirectory>(new CLuceneRAMDirectory());
         ram_directory->__cl_addref(); //trick clucene's lame ref counters
@@ -130,11 +128,17 @@ CLuceneIndex::CLuceneIndex(const string &index_root, const string &index_name, c
 
 
         disk_searcher = shared_ptr<IndexSearcher>(new IndexSearcher(disk_reader.get()));
-        last_refresh  = -1;
+        generation         = 0;
+        refresh_generation = -1;
+        refresh_required   = false;
+        last_refresh       = 0;
 
 
         modifier      = shared_ptr<IndexModifier>(new IndexModifier(ram_directory.get(),analyzer.get(),true));
         last_modified = 0;
+        ram_dirty     = false;
+
+        this->newBuffer();
 
         disk_deletes  = shared_ptr<set<string> >(new set<string>());
 
@@ -178,18 +182,37 @@ shared_ptr<SharedMultiSearcher> CLuceneIndex::getSearcher()
 {
 
     //syncronized in the caller: search()
-    //If we've recently updated the index or synched create a new multi-searcher
-    //if( last_refresh <= last_modified || last_refresh <= last_synched)
+    //If we've updated the index or synched since the last search create a new multi-searcher.
+    //Otherwise the readers (and the field caches hanging off them) are reused.
+    //Changes held in memory wait up to NRT_REFRESH_MS so a stream of puts
+    //doesn't reopen the buffer on every query, hiding a disk doc changes the
+    //filter the old searcher is paired with so that's seen straight away
+    if( searcher.get() == NULL ||
+        (refresh_generation != generation &&
+         (refresh_required || Util::currentTime() - last_refresh >= nrt_refresh)) )
     {
 
-        modifier->flush();
+        //new docs only touch the small buffer, the ram index is flushed
+        //when docs were deleted from it or the buffer was merged in
+        if(ram_dirty){
+            modifier->flush();
+            ram_dirty = false;
+        }
+
+        if(buffer_dirty){
+            this->applyBufferUpdates();
+            buffer_modifier->flush();
+            buffer_dirty = false;
+        }
 
         if(syncing)
-            searcher = shared_ptr<SharedMultiSearcher>(new SharedMultiSearcher(disk_directory,disk_reader,disk_searcher, ram_directory,  ram_prev_directory));
+            searcher = shared_ptr<SharedMultiSearcher>(new SharedMultiSearcher(disk_directory,disk_reader,disk_searcher, ram_directory, buffer_directory, ram_prev_directory));
         else
-            searcher = shared_ptr<SharedMultiSearcher>(new SharedMultiSearcher(disk_directory,disk_reader,disk_searcher, ram_directory));
+            searcher = shared_ptr<SharedMultiSearcher>(new SharedMultiSearcher(disk_directory,disk_reader,disk_searcher, ram_directory, buffer_directory));
 
-        last_refresh = Util::currentTime();
+        refresh_generation = generation;
+        refresh_required   = false;
+        last_refresh       = Util::currentTime();
 
         T_DEBUG("Created new searcher");
     }
@@ -198,7 +221,7 @@ shared_ptr<SharedMultiSearcher> CLuceneIndex::getSearcher()
 }
 
 
-void CLuceneIndex::put( const string &key, lucene::document::Document *doc )
+void CLuceneIndex::put( const string &key, shared_ptr<lucene::document::Document> doc )
 {
 
     if(key.empty()){
@@ -220,29 +243,148 @@ void CLuceneIndex::put( const string &key, lucene::document::Document *doc )
 
     wstring wkey = build_wstring(key);
 
-    //if update to a doc in memory old copy first
-    if( ram_bloom->contains( key ) ){
+    //if update to a doc in memory old copy first, buffered ones are
+    //swapped in one batch by the next refresh (see applyBufferUpdates)
+    if( buffer_docs.find(key) != buffer_docs.end() ){
+
+        buffer_updates.insert(key);
+        T_DEBUG("Updating buffered %s",key.c_str());
+
+    } else if( ram_bloom->contains( key ) ){
 
         Term *t = new Term(DOC_KEY, wkey.c_str() );
 
         l_modifier->deleteDocuments(t);
+        ram_dirty = true;
         T_DEBUG("Updating %s",key.c_str());
 
         delete t;
     }
 
-    l_modifier->addDocument(doc);
+    if(buffer_updates.count(key) == 0)
+        buffer_modifier->addDocument(doc.get());
+
+    buffer_docs[key] = doc;
+    buffer_dirty     = true;
+
     l_ram_bloom->insert( key );
 
     //If this exists already on disk remove it
-    if( l_disk_bloom->contains( key ) ){
+    //(until warmup() has built the bloom filter assume it does)
+    if( !loaded || l_disk_bloom->contains( key ) ){
         l_disk_deletes->insert( key );
 
-        if(!syncing)
+        if(!syncing){
             l_disk_filter->skip(wkey);
+            refresh_required = true;
+        }
     }
 
     last_modified = Util::currentTime();
+    generation++;
+
+    if(first_modified == 0)
+        first_modified = last_modified;
+
+    if(buffer_first_modified == 0)
+        buffer_first_modified = last_modified;
+
+    ram_docs++;
+
+    if(nrt_max_docs > 0 && (int32_t)buffer_docs.size() >= nrt_max_docs)
+        this->mergeBuffer();
+
+    //don't wait for the monitor thread to notice
+    if(this->syncRequired()){
+        Synchronized s(sync_monitor);
+        sync_monitor.notify();
+    }
+}
+
+/**
+ *Large batches skip the buffer, all the deletes are done first so the ram
+ *modifier switches from reader to writer once for the whole batch
+ **/
+void CLuceneIndex::putList(const vector<pair<string, shared_ptr<lucene::document::Document> > > &docs)
+{
+    map<string, shared_ptr<lucene::document::Document> > latest;
+
+    for(size_t i=0; i<docs.size(); i++){
+        if(docs[i].first.empty()){
+            ThrudexException ex;
+            ex.what = "Empty key";
+            throw ex;
+        }
+
+        latest[docs[i].first] = docs[i].second;
+    }
+
+    if(latest.empty())
+        return;
+
+    //RWGuard g( mutex, true );
+    Guard g( mutex );
+
+    map<string, shared_ptr<lucene::document::Document> >::iterator it;
+
+    for(it=latest.begin(); it!=latest.end(); ++it){
+
+        const string &key = it->first;
+        wstring      wkey = build_wstring(key);
+
+        if( buffer_docs.find(key) != buffer_docs.end() ){
+
+            Term *t = new Term(DOC_KEY, wkey.c_str() );
+
+            buffer_modifier->deleteDocuments(t);
+            buffer_docs.erase(key);
+            buffer_updates.erase(key);
+            buffer_dirty = true;
+
+            delete t;
+
+        } else if( ram_bloom->contains( key ) ){
+
+            Term *t = new Term(DOC_KEY, wkey.c_str() );
+
+            modifier->deleteDocuments(t);
+
+            delete t;
+        }
+
+        if( !loaded || disk_bloom->contains( key ) ){
+            disk_deletes->insert( key );
+
+            if(!syncing){
+                disk_filter->skip(wkey);
+                refresh_required = true;
+            }
+        }
+    }
+
+    for(it=latest.begin(); it!=latest.end(); ++it){
+        modifier->addDocument(it->second.get());
+        ram_bloom->insert( it->first );
+    }
+
+    ram_dirty     = true;
+    last_modified = Util::currentTime();
+    generation++;
+
+    if(first_modified == 0)
+        first_modified = last_modified;
+
+    ram_docs += latest.size();
+
+    //once per batch, put() leaves it to mergeBuffer and the monitor thread
+    ram_bytes = ram_directory->sizeInBytes();
+
+    T_DEBUG("Bulk put %d docs",(int)latest.size());
+
+    if(this->syncRequired()){
+        Synchronized s(sync_monitor);
+        sync_monitor.notify();
+    }
 }
 
 void CLuceneIndex::remove(const string &key)
@@ -261,34 +403,57 @@ void CLuceneIndex::remove(const string &key)
 
     //Since we don't want to write to disk
     //We'll simply track the docs to remove on next merge
-    if( l_disk_bloom->contains( key )){
+    if( !loaded || l_disk_bloom->contains( key )){
         T_DEBUG("Removed disk %s",key.c_str());
         l_disk_deletes->insert( key );
 
-        if(!syncing)
+        if(!syncing){
             l_disk_filter->skip(wkey);
+            refresh_required = true;
+        }
 
         last_modified = Util::currentTime();
+        generation++;
     }
 
     //remove from memory if residing there
-    if(l_ram_bloom->contains( key )){
+    if(buffer_docs.find(key) != buffer_docs.end()){
+
+        T_DEBUG( "Removed buffered %s",key.c_str());
+
+        Term      *t = new Term(DOC_KEY, wkey.c_str() );
+
+        buffer_modifier->deleteDocuments(t);
+        buffer_docs.erase(key);
+        buffer_updates.erase(key);
+        buffer_dirty = true;
+
+        last_modified = Util::currentTime();
+        generation++;
+
+        delete t;
+
+    } else if(l_ram_bloom->contains( key )){
 
         T_DEBUG( "Removed ram %s",key.c_str());
 
         Term      *t = new Term(DOC_KEY, wkey.c_str() );
 
         l_modifier->deleteDocuments(t);
+        ram_dirty = true;
 
         last_modified = Util::currentTime();
+        generation++;
 
         delete t;
     }
 
+    if(first_modified == 0 && (!loaded || l_disk_bloom->contains( key ) || l_ram_bloom->contains( key )))
+        first_modified = last_modified;
 }
 
 
-void CLuceneIndex::search(const thrudex::SearchQuery &q, thrudex::SearchResponse &r)
+void CLuceneIndex::search(const thrudex::SearchQuery &q, thrudex::SearchResponse &r, vector<SearchRank> *ranks)
 {
 
     T_DEBUG("Searching in: (%s)",q.index.c_str());
@@ -300,6 +465,11 @@ void CLuceneIndex::search(const thrudex::SearchQuery &q, thrudex::SearchResponse
         throw ex;
     }
 
+    //the clock starts before parsing, 0 means no limit
+    int32_t timeout  = q.timeout_ms > 0 ? q.timeout_ms : search_timeout;
+    int64_t deadline = timeout > 0 ? Util::currentTime() + timeout : 0;
+    bool    complete = true;
+
 
     shared_ptr<IndexSearcher>       l_disk_searcher;
     shared_ptr<UpdateFilter>        l_disk_filter;
@@ -360,33 +530,91 @@ void CLuceneIndex::search(const thrudex::SearchQuery &q, thrudex::SearchResponse
     }
 
 
-    Hits *h;
-    Sort *lsort = NULL;
+    vector<int32_t> docs;
+    vector<float_t> scores;
+    wstring         sortby;
+
+    if(q.offset < 0 || q.limit < 0){
+        _CLDELETE(query);
+
+        ThrudexException ex;
+        ex.what  = "Invalid offset or limit";
+
+        throw ex;
+    }
+
+    //only the docs on the requested page are ever ranked, a page past
+    //INT_MAX can't be reached anyway
+    int64_t         end   = (int64_t)q.offset + q.limit;
+    int32_t         n     = end > INT_MAX ? INT_MAX : (int32_t)end;
 
     try{
 
-        if( q.sortby.empty() ){
-            h = l_searcher->search(query, l_disk_filter.get());
+        //counts every hit, not just the page
+        FacetCollector fc(l_searcher, q.facets);
+
+        if(q.randomize){
+
+            RandomHitCollector hc(q.limit);
+            complete = l_searcher->search(query, l_disk_filter.get(), fc.wrap(&hc), deadline);
+
+            r.total = hc.getTotalHits();
+            hc.getDocs(docs);
+
+        } else if( q.sortby.empty() ){
+
+            TopHitCollector hc(n);
+            complete = l_searcher->search(query, l_disk_filter.get(), fc.wrap(&hc), deadline);
+
+            r.total = hc.getTotalHits();
+            hc.getDocs(docs, &scores);
+
         } else {
 
 
             T_DEBUG("Sorting by: %s %s",q.sortby.c_str(),(q.desc ? "Descending": ""));
 
-            wstring  sortby   = build_wstring( q.sortby+"_sort" );
+            sortby = build_wstring( q.sortby+"_sort" );
 
-            lsort = new Sort();
-            lsort->setSort(  new SortField ( sortby.c_str(), SortField::STRING, q.desc ) );
+            //remember it so the cache is rebuilt before a new disk reader goes live
+            {
+                Guard g(mutex);
+                sort_fields[sortby] = q.sorttype;
+            }
 
             try {
-                h = l_searcher->search(query,l_disk_filter.get(),lsort);
+                SortedHitCollector hc(l_searcher, sortby, q.sorttype, q.desc, n);
+                complete = l_searcher->search(query, l_disk_filter.get(), fc.wrap(&hc), deadline);
+
+                r.total = hc.getTotalHits();
+                hc.getDocs(docs);
+
             } catch(CLuceneError &e) {
 
-                T_INFO( "Sort failed, falling back on regular search");
-                h = l_searcher->search(query,l_disk_filter.get());
+                //an unsorted page would be merged out of order across shards
+                T_ERROR( "Sort by %s failed (%s)",q.sortby.c_str(),e.what());
+
+                _CLDELETE(query);
+
+                ThrudexException ex;
+                ex.what  = "Can't sort by "+q.sortby+": '"+string(e.what())+"'";
+
+                throw ex;
             }
         }
+
+        if(!q.facets.empty()){
+            fc.getFacets(r.facets);
+
+            map<string, map<string, int32_t> >::iterator it;
+            for(it = r.facets.begin(); it != r.facets.end(); ++it)
+                FacetCollector::limitFacets(it->second, q.facet_limit);
+        }
+
     }catch(CLuceneError &e){
 
+        _CLDELETE(query);
+
         ThrudexException ex;
         ex.what  = "Error while performing search: '"+string(e.what())+"'";
 
@@ -394,104 +622,139 @@ void CLuceneIndex::search(const thrudex::SearchQuery &q, thrudex::SearchResponse
 
     }
 
+    _CLDELETE(query);
 
-    char buf[1024];
-
-    r.total = h->length();
-
-    int mlen = h->length();
-
-    if( mlen > 0 ){
+    if(!complete){
+        {
+            Guard g(mutex);
+            timed_out_searches++;
+        }
 
-        if(q.randomize){
+        T_INFO("Search of %s timed out after %dms: %s",index_name.c_str(),timeout,q.query.c_str());
 
-            map<int, bool> unique_lookup;
+        if(!search_timeout_partial){
+            ThrudexException ex;
+            ex.what  = "Search timed out";
 
-            for(int j=0; j<mlen && j<q.limit; j++){
-                int k = 0;
+            throw ex;
+        }
 
-                do{
-                    k = rand() % mlen;
-                }while(unique_lookup.count(k));
+        r.timed_out = true;
+    }
 
-                lucene::document::Document *doc = &h->doc(k);
 
-                const wchar_t *id   = doc->get(DOC_KEY);
+    //the page, in rank order
+    size_t start = q.randomize ? 0 : q.offset;
 
-                if(id == NULL){
+    if(start >= docs.size())
+        return;
 
-                    T_ERROR("Dockey missing from document!")
-                    continue;
-                } else {
+    //load stored fields in doc id order so each segment is read front to back
+    vector< pair<int32_t,size_t> > page;
 
-                    STRCPY_TtoA(buf,id,1024);
+    for(size_t i=start; i<docs.size(); i++)
+        page.push_back( make_pair(docs[i], i-start) );
 
-                    T_DEBUG("ID: %s",buf);
+    sort(page.begin(), page.end());
 
-                    thrudex::Element el;
-                    el.index = q.index;
-                    el.key   = buf;
+    vector<thrudex::Element> elements(page.size());
+    vector<SearchRank>       page_ranks(page.size());
+    vector<bool>             found(page.size(), false);
 
-                    if(q.payload){
-                      const wchar_t *payload = doc->get(DOC_PAYLOAD);
-                      if(payload != NULL){
-                        STRCPY_TtoA(buf,payload,1024);
-                        el.payload = buf;
-                      }
-                    }
+    for(size_t i=0; i<page.size(); i++){
 
-                    r.elements.push_back(el);
+        lucene::document::Document doc;
 
-                    unique_lookup[k] = true;
-                }
-            }
+        try{
+            if( !l_searcher->doc(page[i].first, &doc) )
+                continue;
+        }catch(CLuceneError &e){
+            T_ERROR("Error loading document: %s",e.what());
+            continue;
+        }
 
+        const wchar_t *id   = doc.get(DOC_KEY);
 
-        } else {
+        if(id == NULL) {
+            T_ERROR("Dockey missing from document!")
+            continue;
+        }
 
-            for ( int j=q.offset;j<mlen && j<(q.offset+q.limit); j++ ) {
+        thrudex::Element &el = elements[page[i].second];
 
-                lucene::document::Document *doc = &h->doc(j);
-                const wchar_t *id   = doc->get(DOC_KEY);
+        el.index = q.index;
+        build_string(id, el.key);
 
-                if(id == NULL) {
-                    T_ERROR("Dockey missing from document!")
-                    continue;
-                } else {
-                    STRCPY_TtoA(buf,id,1024);
+        T_DEBUG("ID: %s",el.key.c_str());
 
-                    T_DEBUG("ID: %s",buf);
+        if(q.payload){
+            T_DEBUG("Fetching payload");
+            const wchar_t *payload = doc.get(DOC_PAYLOAD);
+            if(payload != NULL)
+                build_string(payload, el.payload);
+        }
 
-                    thrudex::Element el;
-                    el.index = q.index;
-                    el.key   = buf;
+        if(ranks != NULL){
+            SearchRank &rank = page_ranks[page[i].second];
 
-                    if(q.payload){
-                        T_DEBUG("Fetching payload");
-                        const wchar_t *payload = doc->get(DOC_PAYLOAD);
-                        if(payload != NULL){
-                            STRCPY_TtoA(buf,payload,1024);
-                            el.payload = string(buf);
-                        }
-                    }
+            rank.score = start + page[i].second < scores.size() ? scores[start + page[i].second] : 0;
 
-                    r.elements.push_back(el);
-                }
+            if(!sortby.empty()){
+                const wchar_t *value = doc.get(sortby.c_str());
+                if(value != NULL)
+                    rank.sort_value = value;
             }
         }
+
+        found[page[i].second] = true;
     }
 
+    for(size_t i=0; i<elements.size(); i++){
+        if(found[i]){
+            r.elements.push_back(elements[i]);
 
-    _CLDELETE(h);
-    _CLDELETE(lsort);
-    _CLDELETE(query);
+            if(ranks != NULL)
+                ranks->push_back(page_ranks[i]);
+        }
+    }
 }
 
 void CLuceneIndex::run()
 {
+    //check at least once a second, writers wake us early
+    int64_t check_interval = 1000;
+
+    if(sync_max_age > 0 && sync_max_age < check_interval)
+        check_interval = sync_max_age;
+
+    if(nrt_max_delay > 0 && nrt_max_delay < check_interval)
+        check_interval = nrt_max_delay;
 
     while(1){
-        sleep(10);
+
+        {
+            Synchronized s(sync_monitor);
+
+            try{
+                sync_monitor.wait(check_interval);
+            }catch(TimedOutException &e){
+                //expected
+            }
+        }
+
+        {
+            Guard g(mutex);
+
+            if(this->mergeRequired())
+                this->mergeBuffer();
+
+            //picks up segments the modifier flushed on its own
+            ram_bytes = ram_directory->sizeInBytes();
+
+            if(!this->syncRequired())
+                continue;
+        }
+
         T_DEBUG("Syncing");
         sync();
         T_DEBUG("Syncing Finished");
@@ -499,16 +762,124 @@ void CLuceneIndex::run()
 
 }
 
+/**
+ *True once any of the sync limits are crossed, caller must hold the mutex.
+ *Uses the ram size as last measured, adding up the ram directory's files
+ *on every put would cost more than the put
+ **/
+bool CLuceneIndex::syncRequired()
+{
+    //nothing to write
+    if(first_modified == 0)
+        return false;
+
+    if(sync_max_age > 0 && Util::currentTime() - first_modified >= sync_max_age)
+        return true;
+
+    if(sync_max_docs > 0 && ram_docs >= sync_max_docs)
+        return true;
+
+    if(sync_max_ram_bytes > 0 && ram_bytes >= sync_max_ram_bytes)
+        return true;
+
+    return false;
+}
+
+/**
+ *True once the oldest buffered doc is older than NRT_MAX_DELAY_MS, caller must hold the mutex
+ **/
+bool CLuceneIndex::mergeRequired()
+{
+    if(buffer_first_modified == 0)
+        return false;
+
+    return nrt_max_delay > 0 && Util::currentTime() - buffer_first_modified >= nrt_max_delay;
+}
+
+/**
+ *Moves the buffered docs into the ram index as one batch, caller must hold the mutex
+ **/
+void CLuceneIndex::mergeBuffer()
+{
+    if(buffer_first_modified == 0)
+        return;
+
+    T_DEBUG("Merging %d buffered docs",(int)buffer_docs.size());
+
+    map<string, shared_ptr<lucene::document::Document> >::iterator it;
+    for(it=buffer_docs.begin(); it!=buffer_docs.end(); ++it)
+        modifier->addDocument(it->second.get());
+
+    modifier->flush();
+    ram_dirty = false;
+    ram_bytes = ram_directory->sizeInBytes();
+
+    this->newBuffer();
+
+    generation++;
+}
+
+/**
+ *Swaps in the latest copy of buffered docs that were put again, all the
+ *deletes first so the buffer modifier switches to its reader and back once
+ *per refresh rather than once per put. Caller must hold the mutex
+ **/
+void CLuceneIndex::applyBufferUpdates()
+{
+    if(buffer_updates.empty())
+        return;
+
+    set<string>::iterator it;
+
+    for(it=buffer_updates.begin(); it!=buffer_updates.end(); ++it){
+        wstring wkey = build_wstring(*it);
+        Term    *t   = new Term(DOC_KEY, wkey.c_str() );
+
+        buffer_modifier->deleteDocuments(t);
+
+        delete t;
+    }
+
+    for(it=buffer_updates.begin(); it!=buffer_updates.end(); ++it)
+        buffer_modifier->addDocument(buffer_docs[*it].get());
+
+    T_DEBUG("Updated %d buffered docs",(int)buffer_updates.size());
+
+    buffer_updates.clear();
+}
+
+/**
+ *Starts an empty buffer, caller must hold the mutex
+ **/
+void CLuceneIndex::newBuffer()
+{
+    buffer_directory = shared_ptr<CLuceneRAMDirectory>(new CLuceneRAMDirectory());
+    buffer_directory->__cl_addref(); //trick clucene's lame ref counters
+
+    buffer_modifier.reset(new IndexModifier(buffer_directory.get(),analyzer.get(),true));
+
+    buffer_docs.clear();
+    buffer_updates.clear();
+    buffer_dirty          = false;
+    buffer_first_modified = 0;
+}
+
 void CLuceneIndex::sync(bool force)
 {
     //Any updates
 
     if(!force){
         Guard g(mutex);
-        if(last_modified <= last_synched && disk_deletes->empty())
+        if(first_modified == 0 && disk_deletes->empty())
             return;
     }
 
+    //shards of an index take turns so only one of them pauses at a time
+    Guard l(*sync_lock);
+
+    //one disk writer at a time (optimize, warmup)
+    Guard d(disk_mutex);
+
     T_DEBUG("Syncing Started");
     string idx_path = index_root + "/" + index_name;
 
@@ -528,8 +899,10 @@ void CLuceneIndex::sync(bool force)
 
         syncing = true; //this flag alters the search code to include prev searcher
 
-        //Flush old writer
+        //Flush old writer, buffered docs go along with this sync
+        this->mergeBuffer();
         modifier->flush();
+        ram_dirty = false;
         last_modified = Util::currentTime();
 
         //Grab old handles
@@ -538,7 +911,7 @@ void CLuceneIndex::sync(bool force)
         l_disk_deletes = disk_deletes;
         l_disk_bloom   = disk_bloom;
 
-        l_ram_ro_dir = shared_ptr<CLuceneRAMDirectory>( new CLuceneRAMDirectory( l_ram_directory.get() ) );
+        l_ram_ro_dir = shared_ptr<CLuceneRAMDirectory>( l_ram_directory->snapshot() );
         l_ram_ro_dir->__cl_addref(); //trick clucene's lame ref counters
 
         //create new handles
@@ -548,10 +921,17 @@ void CLuceneIndex::sync(bool force)
         ram_bloom.reset(new bloom_filter(filter_space,1.0/(1.0 * filter_space), random_seed));
         modifier.reset(new IndexModifier(ram_directory.get(),analyzer.get(),true));
 
+        //searches include the docs being merged until the sync is done
         ram_prev_prev_directory = ram_prev_directory;
-        ram_prev_directory      = ram_directory;
+        ram_prev_directory      = l_ram_ro_dir;
 
         disk_deletes.reset(new set<string>());
+
+        ram_docs       = 0;
+        ram_bytes      = 0;
+        first_modified = 0;
+
+        generation++;
     }
 
     T_DEBUG("Created Handles");
@@ -603,6 +983,23 @@ void CLuceneIndex::sync(bool force)
         T_DEBUG("Merged");
     }
 
+    this->reopenDisk();
+
+    {
+        Guard g(mutex);
+        last_synched = Util::currentTime();
+    }
+
+    T_DEBUG("Set new search");
+}
+
+/**
+ *Swaps in a reader on the current disk index, caller must hold the disk_mutex
+ **/
+void CLuceneIndex::reopenDisk()
+{
+    string idx_path = index_root + "/" + index_name;
+
     //Search new index (big perf hit so get it over now)
     shared_ptr<FSDirectory>   l_disk_directory= shared_ptr<FSDirectory>(FSDirectory::getDirectory(idx_path.c_str(),false));
     l_disk_directory->__cl_addref(); //trick clucene's lame ref counters
@@ -623,6 +1020,22 @@ void CLuceneIndex::sync(bool force)
 
     T_DEBUG("Query");
 
+    //load the sort fields now rather than on the first sorted query
+    map<wstring,thrudex::SortType> l_sort_fields;
+    {
+        Guard g(mutex);
+        l_sort_fields = sort_fields;
+    }
+
+    map<wstring,thrudex::SortType>::iterator sit;
+    for(sit=l_sort_fields.begin(); sit!=l_sort_fields.end(); ++sit){
+        try{
+            SortedHitCollector::loadField(l_disk_reader.get(), sit->first.c_str(), sit->second);
+        }catch(CLuceneError &e){
+            T_ERROR("Loading sort field failed: %s",e.what());
+        }
+    }
+
     //replace index handles
     {
         Guard g(mutex);
@@ -643,20 +1056,82 @@ void CLuceneIndex::sync(bool force)
             disk_filter->skip(wkey);
         }
 
-
-        last_synched = Util::currentTime();
-
         syncing = false; //this flag alters the search code to include prev searcher
-    }
 
-    T_DEBUG("Set new search");
+        //the old searcher's disk reader doesn't match the new filter
+        refresh_required = true;
+        generation++;
+    }
 }
 
 
 void CLuceneIndex::optimize()
 {
-    Guard g(mutex);
+    Guard d(disk_mutex);
+
+    this->optimizeDisk();
+    this->reopenDisk();
+}
+
+void CLuceneIndex::snapshot(const string &target_root)
+{
+    //everything written so far goes to disk
+    this->sync(true);
+
+    //nothing rewrites the segment files until they're all linked,
+    //writes carry on into the ram index meanwhile
+    Guard d(disk_mutex);
+
+    string idx_path    = index_root  + "/" + index_name;
+    string target_path = target_root + "/" + index_name;
+
+    boost::filesystem::create_directories( target_path );
+
+    shared_ptr<FSDirectory> l_disk_directory;
+    {
+        Guard g(mutex);
+        l_disk_directory = disk_directory;
+    }
+
+    vector<string> names;
+    l_disk_directory->list(&names);
+
+    for(size_t i=0; i<names.size(); i++){
+
+        if(names[i].size() > 5 && names[i].substr(names[i].size()-5) == ".lock")
+            continue;
+
+        string src = idx_path    + "/" + names[i];
+        string dst = target_path + "/" + names[i];
+
+        //lucene never changes a file once written, so a link is a safe copy
+        if(link(src.c_str(), dst.c_str()) == 0)
+            continue;
+
+        //the disk_mutex keeps files from going away, a missing one is a
+        //broken snapshot
+        if(errno == ENOENT){
+            T_ERROR("Snapshot of %s failed, %s is gone",index_name.c_str(),src.c_str());
+
+            ThrudexException ex;
+            ex.what  = "Snapshot of "+index_name+" failed, missing "+names[i];
+
+            throw ex;
+        }
+
+        T_DEBUG("Can't link %s (%s), copying",src.c_str(),strerror(errno));
 
+        boost::filesystem::copy_file(src, dst);
+    }
+
+    T_INFO("Snapshot of %s written to %s",index_name.c_str(),target_path.c_str());
+}
+
+/**
+ *Caller must hold the disk_mutex, readers and writers carry on in memory
+ **/
+void CLuceneIndex::optimizeDisk()
+{
     T_DEBUG("Start Optimizing");
 
     string idx_path = index_root + "/" + index_name;
@@ -664,6 +1139,127 @@ void CLuceneIndex::optimize()
     //disk_writer->setUseCompoundFile(true);
 
     disk_writer->optimize();
+    disk_writer->close();
 
     T_DEBUG("Stop Optimizing");
 }
+
+/**
+ *Optimizes an existing index and builds its bloom filter.
+ *The index is searchable and writable while this runs, until it's done
+ *every write is treated as a possible update to a doc on disk.
+ **/
+void CLuceneIndex::warmup()
+{
+    if(loaded)
+        return;
+
+    Guard d(disk_mutex);
+
+    T_DEBUG("Warming up %s",index_name.c_str());
+
+    string idx_path = index_root + "/" + index_name;
+
+    try{
+
+        this->optimizeDisk();
+        this->reopenDisk();
+
+        shared_ptr<bloom_filter> l_disk_bloom(new bloom_filter(filter_space,1.0/(1.0 * filter_space), random_seed));
+        shared_ptr<IndexReader>  l_disk_reader;
+
+        {
+            Guard g(mutex);
+            l_disk_reader = disk_reader;
+        }
+
+        int max = l_disk_reader->maxDoc();
+
+        for(int i=0; i<max; i++){
+            try{
+
+                if(l_disk_reader->isDeleted(i))
+                    continue;
+
+                lucene::document::Document *doc = l_disk_reader->document(i);
+                const wchar_t *id   = doc->get( DOC_KEY );
+
+                if(id != NULL){
+                    string key = build_string(id);
+
+                    T_DEBUG("blooming index id: %s(%s)",index_name.c_str(),key.c_str());
+
+                    l_disk_bloom->insert(key);
+                }
+
+                _CLDELETE(doc);
+            }catch(CLuceneError &e){
+                T_ERROR("Error while populating bloom filter: %s",e.what());
+            }
+        }
+
+        {
+            Guard g(mutex);
+
+            //syncs are held off by the disk_mutex so nothing has been merged since the reader opened
+            disk_bloom = l_disk_bloom;
+            loaded     = true;
+        }
+
+    }catch(CLuceneError &e){
+        T_ERROR("Clucene Exception while warming index:%s : %s", idx_path.c_str(),e.what());
+        return;
+    }
+
+    T_INFO("Loaded index %s",index_name.c_str());
+}
+
+bool CLuceneIndex::isLoaded()
+{
+    return loaded;
+}
+
+string CLuceneIndex::stats()
+{
+    shared_ptr<CLuceneRAMDirectory> l_ram_directory;
+    shared_ptr<CLuceneRAMDirectory> l_ram_prev_directory;
+    shared_ptr<FSDirectory>         l_disk_directory;
+    int32_t                         l_ram_docs;
+    int32_t                         l_buffer_docs;
+    int64_t                         l_timed_out;
+    bool                            l_syncing;
+
+    {
+        Guard g(mutex);
+
+        l_ram_directory      = ram_directory;
+        l_ram_prev_directory = ram_prev_directory;
+        l_disk_directory     = disk_directory;
+        l_ram_docs           = ram_docs;
+        l_buffer_docs        = buffer_docs.size();
+        l_syncing            = syncing;
+        l_timed_out          = timed_out_searches;
+    }
+
+    int64_t ram_bytes      = l_ram_directory->sizeInBytes();
+    int64_t prev_ram_bytes = l_syncing ? l_ram_prev_directory->sizeInBytes() : 0;
+    int64_t disk_bytes     = 0;
+
+    vector<string> names;
+    l_disk_directory->list(&names);
+
+    for(unsigned int i=0; i<names.size(); i++){
+        try{
+            disk_bytes += l_disk_directory->fileLength(names[i].c_str());
+        }catch(CLuceneError &e){
+            //removed by a merge
+        }
+    }
+
+    char buf[1024];
+    sprintf(buf, "loaded=%d,ram_bytes=%lld,prev_ram_bytes=%lld,disk_bytes=%lld,ram_docs=%d,buffer_docs=%d,last_synched=%lld,timed_out=%lld",
+            loaded ? 1 : 0, (long long)ram_bytes, (long long)prev_ram_bytes, (long long)disk_bytes,
+            l_ram_docs, l_buffer_docs, (long long)last_synched, (long long)l_timed_out);
+
+    return string(buf);
+}
@@ -12,6 +12,7 @@
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <CLucene.h>
@@ -19,6 +20,7 @@
 #include <CLucene/search/MultiSearcher.h>
 
 #include "Thrudex.h"
+#include "ConfigFile.h"
 #include "CLuceneRAMDirectory.h"
 #include "SharedMultiSearcher.h"
 
@@ -28,6 +30,27 @@ class UpdateFilter;
 #define DOC_KEY L"_doc_key_"
 #define DOC_PAYLOAD L"_payload_"
 
+#define NRT_REFRESH_MS_DEFAULT 100
+
+/**
+ *Reads an index setting from the config file.
+ *"<index>.<KEY>" takes precedence over the global "<KEY>".
+ **/
+template<class T>
+T read_index_config(const std::string &index_name, const std::string &key, const T &value)
+{
+    return ConfigManager->read<T>(index_name+"."+key, ConfigManager->read<T>(key, value));
+}
+
+/**
+ *What a search result was ranked by, lets a sharded index merge its shards
+ **/
+struct SearchRank
+{
+    float_t      score;
+    std::wstring sort_value;   ///< stored _sort value, empty when missing
+};
+
 /***
  *Manages index reads and writes for optimal performance.
  *
@@ -39,7 +62,26 @@ class UpdateFilter;
  *writes and a monitor thread that syncs them to disk once a memory or time limit is reached.
  *This way writes are instantly available to readers with little perf hit. sweet.
  *
+ *The limits are read per index (see read_index_config):
+ *  SYNC_MAX_RAM_BYTES - size of the ram directory, measured on merges, bulk
+ *                       puts and by the monitor thread
+ *  SYNC_MAX_DOCS      - number of docs added since the last sync
+ *  SYNC_MAX_AGE_MS    - age of the oldest change not yet on disk
+ *
+ *New docs first go to a small buffer index that searches read directly, so a
+ *query only has to flush the buffer. The buffered docs are added to the ram
+ *index in one batch once NRT_MAX_BUFFERED_DOCS or NRT_MAX_DELAY_MS is reached.
+ *Searches reuse their searcher for up to NRT_REFRESH_MS after a change, so
+ *the buffer is flushed at most that often however fast docs come in.
+ *
  *Redo logging is employed elsewhere so we can recover if the system crashes before a sync has occurred.
+ *
+ *Searches stop collecting hits once SEARCH_TIMEOUT_MS (or the query's own
+ *timeout_ms) has passed. The partial results come back flagged timed_out,
+ *or the search fails if SEARCH_TIMEOUT_PARTIAL is off.
+ *
+ *Opening an index is cheap, the optimize and bloom filter build of an existing
+ *index happen in warmup() which the backend runs in the background.
  **/
 class CLuceneIndex : public apache::thrift::concurrency::Runnable
 {
@@ -47,41 +89,88 @@ class CLuceneIndex : public apache::thrift::concurrency::Runnable
     CLuceneIndex(const std::string &index_root,
                  const std::string &index_name,
                  const std::size_t &filter_space,
-                 boost::shared_ptr<lucene::analysis::Analyzer> analyzer);
+                 boost::shared_ptr<lucene::analysis::Analyzer> analyzer,
+                 const std::string &config_name = "",
+                 boost::shared_ptr<apache::thrift::concurrency::Mutex> sync_lock = boost::shared_ptr<apache::thrift::concurrency::Mutex>());
 
     ~CLuceneIndex();
 
-    void put(const std::string &key, lucene::document::Document *doc );
+    //the doc is held on to until it leaves the buffer
+    void put(const std::string &key, boost::shared_ptr<lucene::document::Document> doc );
+
+    //bulk put under one lock, a later doc wins over an earlier one with the same key
+    void putList(const std::vector<std::pair<std::string, boost::shared_ptr<lucene::document::Document> > > &docs);
     void remove(const std::string &key);
-    void search(const thrudex::SearchQuery &s, thrudex::SearchResponse &r);
+    void search(const thrudex::SearchQuery &s, thrudex::SearchResponse &r, std::vector<SearchRank> *ranks = NULL);
 
     void run();
 
     void optimize();
+    void warmup();
+    bool isLoaded();
+
+    //syncs, then links (or copies) the disk index to <target_root>/<index_name>
+    void snapshot(const std::string &target_root);
+
+    std::string stats();
 
  private:
     void sync(bool force = false);
+    bool syncRequired();
+    bool mergeRequired();
+    void mergeBuffer();
+    void newBuffer();
+    void applyBufferUpdates();
+    void reopenDisk();
+    void optimizeDisk();
 
     boost::shared_ptr<SharedMultiSearcher>         getSearcher();
     boost::shared_ptr<apache::thrift::concurrency::Thread> monitor_thread;
 
     apache::thrift::concurrency::Mutex             mutex;
+    apache::thrift::concurrency::Mutex             disk_mutex;  ///< held while writing to the disk index
 
     const std::string                                index_root;
     const std::string                                index_name;
+    const std::string                                config_name; ///< name settings are read under
     boost::shared_ptr<lucene::analysis::Analyzer>    analyzer;
 
     std::size_t filter_space;
 
     boost::shared_ptr<lucene::index::IndexModifier>  modifier;
     volatile int64_t                                 last_modified;
+    bool                                             ram_dirty;    ///< modifier has changes to flush
+
+    boost::shared_ptr<lucene::store::CLuceneRAMDirectory>  buffer_directory;
+    boost::shared_ptr<lucene::index::IndexModifier>        buffer_modifier;
+    std::map<std::string, boost::shared_ptr<lucene::document::Document> > buffer_docs;
+    std::set<std::string>                            buffer_updates;  ///< buffered keys put again since the refresh
+    bool                                             buffer_dirty;
+    int64_t                                          buffer_first_modified;
+    int32_t                                          nrt_max_docs;
+    int64_t                                          nrt_max_delay;
+    int64_t                                          nrt_refresh;
 
     boost::shared_ptr<SharedMultiSearcher>           searcher;
-    int64_t                                          last_refresh;
+    int64_t                                          generation;          ///< bumped on every change
+    int64_t                                          refresh_generation;  ///< generation of searcher
+    int64_t                                          last_refresh;        ///< when searcher was built
+    bool                                             refresh_required;    ///< next search can't reuse searcher
 
     int64_t                                          last_synched;
     volatile bool                                    syncing;
 
+    apache::thrift::concurrency::Monitor             sync_monitor;
+    boost::shared_ptr<apache::thrift::concurrency::Mutex> sync_lock;  ///< shared by the shards of an index
+    int64_t                                          sync_max_ram_bytes;
+    int32_t                                          sync_max_docs;
+    int64_t                                          sync_max_age;
+    int32_t                                          ram_docs;
+    int64_t                                          ram_bytes;   ///< size of ram_directory when last measured
+    int64_t                                          first_modified;
+
+    volatile bool                                    loaded;      ///< bloom filter is complete
+
     boost::shared_ptr<lucene::store::FSDirectory>    disk_directory;
     boost::shared_ptr<lucene::index::IndexReader>    disk_reader;
     boost::shared_ptr<UpdateFilter>                  disk_filter;
@@ -89,6 +178,12 @@ class CLuceneIndex : public apache::thrift::concurrency::Runnable
     boost::shared_ptr<bloom_filter>                  disk_bloom;
     boost::shared_ptr<std::set<std::string> >        disk_deletes;
 
+    std::map<std::wstring,thrudex::SortType>         sort_fields; ///< _sort fields queried so far
+
+    int32_t                                          search_timeout;
+    bool                                             search_timeout_partial;
+    int64_t                                          timed_out_searches;
+
     boost::shared_ptr<lucene::store::CLuceneRAMDirectory>  ram_directory;
     boost::shared_ptr<lucene::store::CLuceneRAMDirectory>  ram_prev_directory;
 
@@ -20,6 +20,16 @@
 CL_NS_USE(util)
 CL_NS_DEF(store)
 
+namespace {
+    struct RAMFileDeletor
+    {
+        void operator()(RAMFile *file) const
+        {
+            _CLDELETE(file);
+        }
+    };
+}
+
 CLuceneRAMDirectory::RAMLock::RAMLock(const char* name, CLuceneRAMDirectory* dir)
    : directory(dir)
 {
@@ -69,7 +79,7 @@ void CLuceneRAMDirectory::list(vector<string>* names) const{
 }
 
 CLuceneRAMDirectory::CLuceneRAMDirectory():
-    Directory(),files(true,true)
+    Directory()
 {
 }
 
@@ -116,14 +126,14 @@ void CLuceneRAMDirectory::_copyFromDir(Directory* dir, bool closeDir)
 }
 
 CLuceneRAMDirectory::CLuceneRAMDirectory(Directory* dir):
-    Directory(),files(true,true)
+    Directory()
 {
     _copyFromDir(dir,false);
 
 }
 
 CLuceneRAMDirectory::CLuceneRAMDirectory(const char* dir):
-    Directory(),files(true,true)
+    Directory()
 {
     Directory* fsdir = FSDirectory::getDirectory(dir,false);
     try{
@@ -132,32 +142,68 @@ CLuceneRAMDirectory::CLuceneRAMDirectory(const char* dir):
 
 }
 
+CLuceneRAMDirectory* CLuceneRAMDirectory::snapshot() const
+{
+    CLuceneRAMDirectory* dir = _CLNEW CLuceneRAMDirectory();
+
+    SCOPED_LOCK_MUTEX(files_mutex);
+
+    //same files _copyFromDir would take, locks stay behind
+    FileMap::const_iterator itr = files.begin();
+    while (itr != files.end()){
+        if ( CL_NS(index)::IndexReader::isLuceneFile(itr->first.c_str()) )
+            dir->files.insert(*itr);
+        ++itr;
+    }
+
+    return dir;
+}
+
 bool CLuceneRAMDirectory::fileExists(const char* name) const {
     SCOPED_LOCK_MUTEX(files_mutex);
-    return files.exists(name);
+    return files.find(name) != files.end();
 }
 
 int64_t CLuceneRAMDirectory::fileModified(const char* name) const {
     SCOPED_LOCK_MUTEX(files_mutex);
-    const RAMFile* f = files.get(name);
-    return f->lastModified;
+    FileMap::const_iterator itr = files.find(name);
+    if (itr == files.end())
+        return 0;
+
+    return itr->second->lastModified;
 }
 
 int64_t CLuceneRAMDirectory::fileLength(const char* name) const{
     SCOPED_LOCK_MUTEX(files_mutex);
-    RAMFile* f = files.get(name);
-    return f->length;
+    FileMap::const_iterator itr = files.find(name);
+    if (itr == files.end())
+        return 0;
+
+    return itr->second->length;
 }
 
+int64_t CLuceneRAMDirectory::sizeInBytes() const{
+    SCOPED_LOCK_MUTEX(files_mutex);
+
+    int64_t size = 0;
+
+    FileMap::const_iterator itr = files.begin();
+    while (itr != files.end()){
+        size += itr->second->length;
+        ++itr;
+    }
+
+    return size;
+}
 
 IndexInput* CLuceneRAMDirectory::openInput(const char* name) {
     SCOPED_LOCK_MUTEX(files_mutex);
-    RAMFile* file = files.get(name);
-    if (file == NULL) {
+    FileMap::iterator itr = files.find(name);
+    if (itr == files.end()) {
         return NULL;
     }
 
-    return _CLNEW RAMIndexInput( file );
+    return _CLNEW RAMIndexInput( itr->second.get() );
 }
 
 void CLuceneRAMDirectory::close(){
@@ -167,7 +213,7 @@ void CLuceneRAMDirectory::close(){
 
 bool CLuceneRAMDirectory::doDeleteFile(const char* name) {
     SCOPED_LOCK_MUTEX(files_mutex);
-    files.remove(name);
+    files.erase(name);
     return true;
 }
 
@@ -175,31 +221,28 @@ void CLuceneRAMDirectory::renameFile(const char* from, const char* to) {
     SCOPED_LOCK_MUTEX(files_mutex);
     FileMap::iterator itr = files.find(from);
 
-    /* DSR:CL_BUG_LEAK:
-    ** If a file named $to already existed, its old value was leaked.
-    ** My inclination would be to prevent this implicit deletion with an
-    ** exception, but it happens routinely in CLucene's internals (e.g., during
-    ** IndexWriter.addIndexes with the file named 'segments'). */
-    if (files.exists(to)) {
-        files.remove(to);
-    }
     if ( itr == files.end() ){
         char tmp[1024];
         _snprintf(tmp,1024,"cannot rename %s, file does not exist",from);
         _CLTHROWT(CL_ERR_IO,tmp);
     }
-    CND_PRECONDITION(itr != files.end(), "itr==files.end()")
-        RAMFile* file = itr->second;
-    files.removeitr(itr,false,true);
-    files.put(STRDUP_AtoA(to), file);
+
+    //replaces any file named $to, snapshots holding it keep their copy
+    boost::shared_ptr<RAMFile> file = itr->second;
+    files.erase(itr);
+    files[to] = file;
 }
 
 
 void CLuceneRAMDirectory::touchFile(const char* name) {
-    RAMFile* file = NULL;
+    boost::shared_ptr<RAMFile> file;
     {
         SCOPED_LOCK_MUTEX(files_mutex);
-        file = files.get(name);
+        FileMap::iterator itr = files.find(name);
+        if (itr == files.end())
+            return;
+
+        file = itr->second;
     }
     uint64_t ts1 = file->lastModified;
     uint64_t ts2 = Misc::currentTimeMillis();
@@ -214,29 +257,21 @@ void CLuceneRAMDirectory::touchFile(const char* name) {
 }
 
 IndexOutput* CLuceneRAMDirectory::createOutput(const char* name) {
-    /* Check the $files VoidMap to see if there was a previous file named
-    ** $name.  If so, delete the old RAMFile object, but reuse the existing
-    ** char buffer ($n) that holds the filename.  If not, duplicate the
-    ** supplied filename buffer ($name) and pass ownership of that memory ($n)
-    ** to $files. */
+    /* Always start a new RAMFile, an existing file named $name is dropped
+    ** from this directory but stays alive in any snapshot sharing it. */
 
     SCOPED_LOCK_MUTEX(files_mutex);
 
-    const char* n = files.getKey(name);
-    if (n != NULL) {
-        RAMFile* rf = files.get(name);
-        _CLDELETE(rf);
-    } else {
-        n = STRDUP_AtoA(name);
-    }
+    boost::shared_ptr<RAMFile> file(_CLNEW RAMFile(), RAMFileDeletor());
+
+    FileMap::iterator itr = files.insert(FileMap::value_type(name,file)).first;
+    itr->second = file;
 
-    RAMFile* file = _CLNEW RAMFile();
 #ifdef _DEBUG
-    file->filename = n;
+    file->filename = itr->first.c_str();
 #endif
-    files[n] = file;
 
-    return _CLNEW RAMIndexOutput(file);
+    return _CLNEW RAMIndexOutput(file.get());
 }
 
 LuceneLock* CLuceneRAMDirectory::makeLock(const char* name) {
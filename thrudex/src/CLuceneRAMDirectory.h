@@ -19,10 +19,19 @@
 #include "CLucene/util/Arrays.h"
 #include "CLucene/store/RAMDirectory.h"
 
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+
 CL_NS_DEF(store)
 
 /**
  * A memory-resident {@link Directory} implementation.
+ *
+ * Files are shared between a directory and its snapshots. Lucene never
+ * rewrites a closed file (createOutput always starts a new RAMFile), so a
+ * snapshot of a flushed directory stays valid while the original keeps
+ * changing, and taking one only copies the file table.
  */
 class CLuceneRAMDirectory:public Directory{
 
@@ -39,9 +48,7 @@ class CLuceneRAMDirectory:public Directory{
         virtual TCHAR* toString();
     };
 
-    typedef CL_NS(util)::CLHashMap<const char*,RAMFile*,
-        CL_NS(util)::Compare::Char, CL_NS(util)::Equals::Char,
-        CL_NS(util)::Deletor::acArray , CL_NS(util)::Deletor::Object<RAMFile> > FileMap;
+    typedef std::map<std::string, boost::shared_ptr<RAMFile> > FileMap;
  protected:
     /// Removes an existing file in the directory.
     virtual bool doDeleteFile(const char* name);
@@ -75,6 +82,12 @@ class CLuceneRAMDirectory:public Directory{
     virtual ~CLuceneRAMDirectory();
     CLuceneRAMDirectory(Directory* dir);
 
+    /**
+     * Returns a new directory sharing this one's index files.
+     * The caller must make sure no IndexOutput is open on this directory.
+     */
+    CLuceneRAMDirectory* snapshot() const;
+
     /**
      * Creates a new <code>RAMDirectory</code> instance from the {@link FSDirectory}.
      *
@@ -91,6 +104,9 @@ class CLuceneRAMDirectory:public Directory{
     /// Returns the length in bytes of a file in the directory.
     int64_t fileLength(const char* name) const;
 
+    /// Returns the total length in bytes of all files in the directory.
+    int64_t sizeInBytes() const;
+
     /// Removes an existing file in the directory.
     virtual void renameFile(const char* from, const char* to);
 
@@ -0,0 +1,384 @@
+#ifdef HAVE_CONFIG_H
+#include "thrudex_config.h"
+#endif
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include "CLuceneShardedIndex.h"
+#include "HitCollectors.h"
+#include "ThrudexBackend.h"
+#include "ConfigFile.h"
+#include "utils.h"
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#include "ThruLogging.h"
+
+namespace fs = boost::filesystem;
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift::concurrency;
+using namespace thrudex;
+
+
+/**
+ *FNV-1a, shard routing has to stay the same across builds and boost versions
+ **/
+static uint32_t shard_hash(const string &key)
+{
+    uint32_t h = 2166136261U;
+
+    for(size_t i=0; i<key.size(); i++){
+        h ^= (unsigned char)key[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static string shard_name(size_t i)
+{
+    char buf[32];
+    sprintf(buf, "shard%d", (int)i);
+
+    return string(buf);
+}
+
+/**
+ *Same ordering as SortedHitCollector, missing values sort first
+ **/
+static int32_t compare_sort_values(const wstring &a, const wstring &b, SortType type)
+{
+    if(type == INT){
+        long x = a.empty() ? 0 : wcstol(a.c_str(), NULL, 10);
+        long y = b.empty() ? 0 : wcstol(b.c_str(), NULL, 10);
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+
+    if(type == FLOAT){
+        double x = a.empty() ? 0 : wcstod(a.c_str(), NULL);
+        double y = b.empty() ? 0 : wcstod(b.c_str(), NULL);
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+
+    if(a.empty() || b.empty())
+        return (a.empty() ? -1 : 0) + (b.empty() ? 1 : 0);
+
+    int32_t c = wcscmp(a.c_str(), b.c_str());
+
+    return c < 0 ? -1 : (c > 0 ? 1 : 0);
+}
+
+/**
+ *True if a ranks strictly ahead of b
+ **/
+static bool rank_before(const SearchQuery &q, const SearchRank &a, const SearchRank &b)
+{
+    if(q.sortby.empty())
+        return a.score > b.score;
+
+    int32_t c = compare_sort_values(a.sort_value, b.sort_value, q.sorttype);
+
+    return q.desc ? c > 0 : c < 0;
+}
+
+
+CLuceneShardedIndex::CLuceneShardedIndex(const string &index_root, const string &index_name,
+                                         const size_t &filter_space, shared_ptr<lucene::analysis::Analyzer> analyzer)
+    : index_name(index_name), sync_lock(new Mutex())
+{
+    string idx_path = index_root + "/" + index_name;
+
+    //existing sharded index
+    size_t num_shards = 0;
+
+    while(directory_exists( idx_path + "/" + shard_name(num_shards) ))
+        num_shards++;
+
+    int32_t configured = read_index_config<int32_t>(index_name, "SHARDS", 1);
+
+    bool on_disk = num_shards > 0;
+
+    if(!on_disk){
+
+        //existing plain index stays that way
+        on_disk = lucene::index::IndexReader::indexExists( idx_path.c_str() );
+
+        if(on_disk)
+            num_shards = 1;
+        else
+            num_shards = configured > 1 ? configured : 1;
+    }
+
+    if(on_disk && configured > 1 && (size_t)configured != num_shards)
+        T_INFO("Index %s has %d shards on disk, ignoring SHARDS=%d",index_name.c_str(),(int)num_shards,configured);
+
+    if(num_shards == 1){
+
+        shards.push_back( shared_ptr<CLuceneIndex>(new CLuceneIndex(index_root, index_name, filter_space, analyzer,
+                                                                    index_name, sync_lock)) );
+        return;
+    }
+
+    if(!directory_exists( idx_path ))
+        fs::create_directories( idx_path );
+
+    size_t shard_filter_space = filter_space / num_shards + 1;
+
+    for(size_t i=0; i<num_shards; i++){
+        shards.push_back( shared_ptr<CLuceneIndex>(new CLuceneIndex(idx_path, shard_name(i), shard_filter_space, analyzer,
+                                                                    index_name, sync_lock)) );
+    }
+
+    T_DEBUG("Opened %s with %d shards",index_name.c_str(),(int)num_shards);
+}
+
+size_t CLuceneShardedIndex::shardFor(const string &key)
+{
+    return shard_hash(key) % shards.size();
+}
+
+void CLuceneShardedIndex::put(const string &key, shared_ptr<lucene::document::Document> doc)
+{
+    shards[ this->shardFor(key) ]->put(key, doc);
+}
+
+void CLuceneShardedIndex::remove(const string &key)
+{
+    shards[ this->shardFor(key) ]->remove(key);
+}
+
+void CLuceneShardedIndex::putList(const vector<pair<string, shared_ptr<lucene::document::Document> > > &docs)
+{
+    if(shards.size() == 1){
+        shards[0]->putList(docs);
+        return;
+    }
+
+    vector<vector<pair<string, shared_ptr<lucene::document::Document> > > > batches(shards.size());
+
+    for(size_t i=0; i<docs.size(); i++)
+        batches[ this->shardFor(docs[i].first) ].push_back(docs[i]);
+
+    ThrudexException         none;
+    vector<ThrudexException> exceptions(shards.size(), none);
+
+    //each shard has its own lock so they are written in parallel
+    ThrudexBackend::runBatch(shards.size(), boost::bind(&CLuceneShardedIndex::putShard, this, boost::cref(batches),
+                                                        boost::ref(exceptions), _1));
+
+    for(size_t i=0; i<exceptions.size(); i++){
+        if(!exceptions[i].what.empty())
+            throw exceptions[i];
+    }
+}
+
+void CLuceneShardedIndex::putShard(const vector<vector<pair<string, shared_ptr<lucene::document::Document> > > > &batches,
+                                   vector<ThrudexException> &exceptions, size_t shard)
+{
+    if(batches[shard].empty())
+        return;
+
+    try{
+        shards[shard]->putList(batches[shard]);
+    }catch(ThrudexException e){
+        exceptions[shard] = e;
+    }catch(std::exception &e){
+        exceptions[shard].what = e.what();
+    }catch(...){
+        exceptions[shard].what = "Unknown error during put";
+    }
+}
+
+void CLuceneShardedIndex::search(const SearchQuery &q, SearchResponse &r)
+{
+    if(shards.size() == 1){
+        shards[0]->search(q, r);
+        return;
+    }
+
+    if(q.offset < 0 || q.limit < 0){
+        ThrudexException ex;
+        ex.what  = "Invalid offset or limit";
+
+        throw ex;
+    }
+
+    //each shard ranks the whole page, the merge below cuts it down
+    SearchQuery sq = q;
+
+    if(!q.randomize){
+        int64_t end = (int64_t)q.offset + q.limit;
+
+        sq.offset = 0;
+        sq.limit  = end > INT_MAX ? INT_MAX : (int32_t)end;
+    }
+
+    //a value outside one shard's top n can still make the merged top n
+    sq.facet_limit = 0;
+
+    vector<SearchResponse>       responses(shards.size());
+    vector<vector<SearchRank> >  ranks(shards.size());
+
+    ThrudexBackend::runBatch(shards.size(), boost::bind(&CLuceneShardedIndex::searchShard, this, boost::cref(sq),
+                                                        boost::ref(responses), boost::ref(ranks), _1));
+
+    r.total = 0;
+
+    for(size_t i=0; i<responses.size(); i++){
+        if(!responses[i].ex.what.empty())
+            throw responses[i].ex;
+
+        r.total += responses[i].total;
+
+        if(responses[i].timed_out)
+            r.timed_out = true;
+
+        map<string, map<string, int32_t> >::iterator f;
+        for(f = responses[i].facets.begin(); f != responses[i].facets.end(); ++f){
+
+            map<string, int32_t> &counts = r.facets[f->first];
+
+            for(map<string, int32_t>::iterator v = f->second.begin(); v != f->second.end(); ++v)
+                counts[v->first] += v->second;
+        }
+    }
+
+    for(map<string, map<string, int32_t> >::iterator f = r.facets.begin(); f != r.facets.end(); ++f)
+        FacetCollector::limitFacets(f->second, q.facet_limit);
+
+    vector<size_t> pos(shards.size(), 0);
+
+    if(q.randomize){
+
+        //pick shards in proportion to how many docs they matched
+        vector<int64_t> remaining(shards.size(), 0);
+
+        for(size_t i=0; i<responses.size(); i++){
+            if(!responses[i].elements.empty())
+                remaining[i] = responses[i].total > (int32_t)responses[i].elements.size() ?
+                    responses[i].total : responses[i].elements.size();
+        }
+
+        while((int32_t)r.elements.size() < q.limit){
+
+            int64_t sum = 0;
+            for(size_t i=0; i<remaining.size(); i++)
+                sum += remaining[i];
+
+            if(sum == 0)
+                break;
+
+            int64_t pick  = rand() % sum;
+            size_t  shard = 0;
+
+            while(pick >= remaining[shard]){
+                pick -= remaining[shard];
+                shard++;
+            }
+
+            r.elements.push_back( responses[shard].elements[pos[shard]++] );
+            remaining[shard]--;
+
+            if(pos[shard] >= responses[shard].elements.size())
+                remaining[shard] = 0;
+        }
+
+        return;
+    }
+
+    int32_t skipped = 0;
+
+    while((int32_t)r.elements.size() < q.limit){
+
+        //ties go to the lower shard
+        int32_t best = -1;
+
+        for(size_t i=0; i<shards.size(); i++){
+            if(pos[i] >= ranks[i].size())
+                continue;
+
+            if(best < 0 || rank_before(q, ranks[i][pos[i]], ranks[best][pos[best]]))
+                best = i;
+        }
+
+        if(best < 0)
+            break;
+
+        if(skipped < q.offset)
+            skipped++;
+        else
+            r.elements.push_back( responses[best].elements[pos[best]] );
+
+        pos[best]++;
+    }
+}
+
+void CLuceneShardedIndex::searchShard(const SearchQuery &q, vector<SearchResponse> &responses,
+                                      vector<vector<SearchRank> > &ranks, size_t shard)
+{
+    try{
+        shards[shard]->search(q, responses[shard], &ranks[shard]);
+    }catch(ThrudexException e){
+        responses[shard].ex = e;
+    }catch(std::exception &e){
+        responses[shard].ex.what = e.what();
+    }catch(...){
+        responses[shard].ex.what = "Unknown error during search";
+    }
+}
+
+void CLuceneShardedIndex::optimize()
+{
+    for(size_t i=0; i<shards.size(); i++)
+        shards[i]->optimize();
+}
+
+void CLuceneShardedIndex::warmup()
+{
+    for(size_t i=0; i<shards.size(); i++)
+        shards[i]->warmup();
+}
+
+void CLuceneShardedIndex::snapshot(const string &target_root)
+{
+    if(shards.size() == 1){
+        shards[0]->snapshot(target_root);
+        return;
+    }
+
+    for(size_t i=0; i<shards.size(); i++)
+        shards[i]->snapshot(target_root + "/" + index_name);
+}
+
+bool CLuceneShardedIndex::isLoaded()
+{
+    for(size_t i=0; i<shards.size(); i++){
+        if(!shards[i]->isLoaded())
+            return false;
+    }
+
+    return true;
+}
+
+string CLuceneShardedIndex::stats()
+{
+    if(shards.size() == 1)
+        return "index="+index_name+","+shards[0]->stats()+"\n";
+
+    string stats;
+
+    for(size_t i=0; i<shards.size(); i++)
+        stats += "index="+index_name+","+shard_name(i)+","+shards[i]->stats()+"\n";
+
+    return stats;
+}
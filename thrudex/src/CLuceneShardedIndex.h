@@ -0,0 +1,63 @@
+#ifndef __CLUCENE_SHARDED_INDEX_H__
+#define __CLUCENE_SHARDED_INDEX_H__
+
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Mutex.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Thrudex.h"
+#include "CLuceneIndex.h"
+
+/**
+ *Splits an index over SHARDS independent CLuceneIndex instances so writes
+ *to different shards don't wait on each other.
+ *
+ *Docs go to a shard by a hash of their key. Searches run on every shard and
+ *the top hits are merged by score or by the _sort field. The shards sync
+ *one at a time.
+ *
+ *A sharded index lives in <idx_root>/<name>/shard0..N-1. The shard count of
+ *an existing index comes from disk, SHARDS (default 1) only applies to new
+ *indexes. A single shard keeps the plain <idx_root>/<name> layout.
+ **/
+class CLuceneShardedIndex
+{
+ public:
+    CLuceneShardedIndex(const std::string &index_root,
+                        const std::string &index_name,
+                        const std::size_t &filter_space,
+                        boost::shared_ptr<lucene::analysis::Analyzer> analyzer);
+
+    void put(const std::string &key, boost::shared_ptr<lucene::document::Document> doc );
+    void putList(const std::vector<std::pair<std::string, boost::shared_ptr<lucene::document::Document> > > &docs);
+    void remove(const std::string &key);
+    void search(const thrudex::SearchQuery &s, thrudex::SearchResponse &r);
+
+    void optimize();
+    void warmup();
+    bool isLoaded();
+
+    //copies the index under target_root with the same layout
+    void snapshot(const std::string &target_root);
+
+    //one line per shard
+    std::string stats();
+
+ private:
+    std::size_t shardFor(const std::string &key);
+
+    void putShard   (const std::vector<std::vector<std::pair<std::string, boost::shared_ptr<lucene::document::Document> > > > &batches,
+                     std::vector<thrudex::ThrudexException> &exceptions, size_t shard);
+    void searchShard(const thrudex::SearchQuery &q, std::vector<thrudex::SearchResponse> &responses,
+                     std::vector<std::vector<SearchRank> > &ranks, size_t shard);
+
+    const std::string                                      index_name;
+    std::vector<boost::shared_ptr<CLuceneIndex> >          shards;
+    boost::shared_ptr<apache::thrift::concurrency::Mutex>  sync_lock;
+};
+
+#endif
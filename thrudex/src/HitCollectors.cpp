@@ -0,0 +1,347 @@
+#include "HitCollectors.h"
+#include "utils.h"
+#include "ThruLogging.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace std;
+using namespace boost;
+using namespace lucene::index;
+using namespace lucene::search;
+
+//a huge limit is legal, the vectors grow with the hits past this
+static const int32_t reserve_limit = 1024;
+
+
+TopHitCollector::TopHitCollector(int32_t n)
+    : max_size(n), total_hits(0)
+{
+    if(max_size < 0)
+        max_size = 0;
+
+    heap.reserve(min(max_size, reserve_limit));
+}
+
+/**
+ *Same ordering as lucene's HitQueue, ties go to the lower doc id
+ **/
+bool TopHitCollector::better(const ScoredDoc &a, const ScoredDoc &b)
+{
+    if(a.score == b.score)
+        return a.doc < b.doc;
+
+    return a.score > b.score;
+}
+
+void TopHitCollector::collect(const int32_t doc, const float_t score)
+{
+    total_hits++;
+
+    if(max_size == 0)
+        return;
+
+    ScoredDoc sd;
+    sd.doc   = doc;
+    sd.score = score;
+
+    if((int32_t)heap.size() < max_size){
+        heap.push_back(sd);
+        push_heap(heap.begin(), heap.end(), better);
+        return;
+    }
+
+    //worse than everything we have
+    if(!better(sd, heap.front()))
+        return;
+
+    pop_heap(heap.begin(), heap.end(), better);
+    heap.back() = sd;
+    push_heap(heap.begin(), heap.end(), better);
+}
+
+int32_t TopHitCollector::getTotalHits()
+{
+    return total_hits;
+}
+
+void TopHitCollector::getDocs(vector<int32_t> &docs, vector<float_t> *scores)
+{
+    vector<ScoredDoc> sorted(heap);
+    sort(sorted.begin(), sorted.end(), better);
+
+    docs.clear();
+    docs.reserve(sorted.size());
+
+    for(size_t i=0; i<sorted.size(); i++)
+        docs.push_back(sorted[i].doc);
+
+    if(scores != NULL){
+        scores->clear();
+
+        for(size_t i=0; i<sorted.size(); i++)
+            scores->push_back(sorted[i].score);
+    }
+}
+
+
+SortedHitCollector::SortedHitCollector(shared_ptr<SharedMultiSearcher> searcher, const wstring &field,
+                                       thrudex::SortType type, bool desc, int32_t n)
+    : searcher(searcher), type(type), desc(desc), max_size(n), total_hits(0)
+{
+    if(max_size < 0)
+        max_size = 0;
+
+    heap.reserve(min(max_size, reserve_limit));
+
+    for(int32_t i=0; i<searcher->numReaders(); i++)
+        values.push_back( loadField(searcher->getReader(i), field.c_str(), type) );
+}
+
+FieldCacheAuto *SortedHitCollector::loadField(IndexReader *reader, const TCHAR *field, thrudex::SortType type)
+{
+    switch(type){
+        case thrudex::INT:
+            return FieldCache::DEFAULT->getInts(reader, field);
+        case thrudex::FLOAT:
+            return FieldCache::DEFAULT->getFloats(reader, field);
+        default:
+            return FieldCache::DEFAULT->getStringIndex(reader, field);
+    };
+}
+
+int32_t SortedHitCollector::compare(const SortedDoc &a, const SortedDoc &b) const
+{
+    int32_t c = 0;
+
+    switch(type){
+        case thrudex::INT:
+            c = a.ival < b.ival ? -1 : (a.ival > b.ival ? 1 : 0);
+            break;
+        case thrudex::FLOAT:
+            c = a.fval < b.fval ? -1 : (a.fval > b.fval ? 1 : 0);
+            break;
+        default:
+            //ordinals are only comparable within a reader
+            if(a.reader == b.reader)
+                c = a.ord < b.ord ? -1 : (a.ord > b.ord ? 1 : 0);
+            else if(a.str == NULL || b.str == NULL)
+                c = (a.str == NULL ? -1 : 0) + (b.str == NULL ? 1 : 0);
+            else
+                c = _tcscmp(a.str, b.str);
+    };
+
+    return desc ? -c : c;
+}
+
+/**
+ *True if a ranks ahead of b, ties go to the lower doc id
+ **/
+bool SortedHitCollector::before(const SortedDoc &a, const SortedDoc &b) const
+{
+    int32_t c = compare(a, b);
+
+    if(c == 0)
+        return a.doc < b.doc;
+
+    return c < 0;
+}
+
+void SortedHitCollector::collect(const int32_t doc, const float_t score)
+{
+    total_hits++;
+
+    if(max_size == 0)
+        return;
+
+    SortedDoc sd;
+    sd.doc    = doc;
+    sd.reader = searcher->subReader(doc);
+    sd.ord    = 0;
+    sd.str    = NULL;
+    sd.ival   = 0;
+    sd.fval   = 0;
+
+    int32_t        local = searcher->subDoc(doc);
+    FieldCacheAuto *fa   = values[sd.reader];
+
+    switch(type){
+        case thrudex::INT:
+            sd.ival = fa->intArray[local];
+            break;
+        case thrudex::FLOAT:
+            sd.fval = fa->floatArray[local];
+            break;
+        default:
+            sd.ord  = fa->stringIndex->order[local];
+            sd.str  = fa->stringIndex->lookup[sd.ord];
+    };
+
+    Before cmp(this);
+
+    if((int32_t)heap.size() < max_size){
+        heap.push_back(sd);
+        push_heap(heap.begin(), heap.end(), cmp);
+        return;
+    }
+
+    if(!before(sd, heap.front()))
+        return;
+
+    pop_heap(heap.begin(), heap.end(), cmp);
+    heap.back() = sd;
+    push_heap(heap.begin(), heap.end(), cmp);
+}
+
+int32_t SortedHitCollector::getTotalHits()
+{
+    return total_hits;
+}
+
+void SortedHitCollector::getDocs(vector<int32_t> &docs)
+{
+    vector<SortedDoc> sorted(heap);
+    sort(sorted.begin(), sorted.end(), Before(this));
+
+    docs.clear();
+    docs.reserve(sorted.size());
+
+    for(size_t i=0; i<sorted.size(); i++)
+        docs.push_back(sorted[i].doc);
+}
+
+
+RandomHitCollector::RandomHitCollector(int32_t n)
+    : max_size(n), total_hits(0)
+{
+    if(max_size < 0)
+        max_size = 0;
+
+    sample.reserve(min(max_size, reserve_limit));
+}
+
+void RandomHitCollector::collect(const int32_t doc, const float_t score)
+{
+    total_hits++;
+
+    if((int32_t)sample.size() < max_size){
+        sample.push_back(doc);
+        return;
+    }
+
+    if(max_size == 0)
+        return;
+
+    int32_t k = rand() % total_hits;
+
+    if(k < max_size)
+        sample[k] = doc;
+}
+
+int32_t RandomHitCollector::getTotalHits()
+{
+    return total_hits;
+}
+
+void RandomHitCollector::getDocs(vector<int32_t> &docs)
+{
+    docs = sample;
+
+    //the reservoir keeps the first hits in order, mix them up too
+    random_shuffle(docs.begin(), docs.end());
+}
+
+
+FacetCollector::FacetCollector(shared_ptr<SharedMultiSearcher> searcher, const vector<string> &fields)
+    : searcher(searcher), collector(NULL)
+{
+    for(size_t i=0; i<fields.size(); i++){
+
+        Facet f;
+        f.field = fields[i];
+
+        wstring wfield = build_wstring(fields[i]);
+
+        try{
+
+            for(int32_t j=0; j<searcher->numReaders(); j++){
+                FieldCacheAuto *fa = FieldCache::DEFAULT->getStringIndex(searcher->getReader(j), wfield.c_str());
+
+                f.values.push_back(fa);
+                f.counts.push_back(vector<int32_t>(fa->stringIndex->count, 0));
+            }
+
+        }catch(CLuceneError &e){
+            T_ERROR("Can't facet on %s: %s",fields[i].c_str(),e.what());
+            continue;
+        }
+
+        facets.push_back(f);
+    }
+}
+
+HitCollector *FacetCollector::wrap(HitCollector *collector)
+{
+    if(facets.empty())
+        return collector;
+
+    this->collector = collector;
+
+    return this;
+}
+
+void FacetCollector::collect(const int32_t doc, const float_t score)
+{
+    int32_t reader = searcher->subReader(doc);
+    int32_t local  = searcher->subDoc(doc);
+
+    for(size_t i=0; i<facets.size(); i++)
+        facets[i].counts[reader][ facets[i].values[reader]->stringIndex->order[local] ]++;
+
+    collector->collect(doc, score);
+}
+
+void FacetCollector::getFacets(map<string, map<string, int32_t> > &result)
+{
+    string value;
+
+    for(size_t i=0; i<facets.size(); i++){
+
+        map<string, int32_t> &counts = result[facets[i].field];
+
+        for(size_t j=0; j<facets[i].counts.size(); j++){
+
+            const vector<int32_t> &c = facets[i].counts[j];
+
+            //ord 0 is docs without the field
+            for(size_t ord=1; ord<c.size(); ord++){
+                if(c[ord] == 0)
+                    continue;
+
+                build_string(facets[i].values[j]->stringIndex->lookup[ord], value);
+                counts[value] += c[ord];
+            }
+        }
+    }
+}
+
+static bool more_common(const pair<string, int32_t> &a, const pair<string, int32_t> &b)
+{
+    if(a.second == b.second)
+        return a.first < b.first;
+
+    return a.second > b.second;
+}
+
+void FacetCollector::limitFacets(map<string, int32_t> &counts, int32_t n)
+{
+    if(n <= 0 || counts.size() <= (size_t)n)
+        return;
+
+    vector<pair<string, int32_t> > sorted(counts.begin(), counts.end());
+
+    partial_sort(sorted.begin(), sorted.begin() + n, sorted.end(), more_common);
+
+    counts.clear();
+    counts.insert(sorted.begin(), sorted.begin() + n);
+}
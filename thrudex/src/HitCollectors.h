@@ -0,0 +1,167 @@
+#ifndef __HIT_COLLECTORS_H__
+#define __HIT_COLLECTORS_H__
+
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include <CLucene.h>
+#include <CLucene/search/SearchHeader.h>
+#include <CLucene/search/FieldCache.h>
+
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Thrudex.h"
+#include "SharedMultiSearcher.h"
+
+/**
+ *Keeps the best n hits by score in a bounded heap, so a page of results
+ *never costs more than offset+limit entries no matter how many docs match.
+ **/
+class TopHitCollector : public lucene::search::HitCollector
+{
+ public:
+    TopHitCollector(int32_t n);
+
+    void collect(const int32_t doc, const float_t score);
+
+    int32_t getTotalHits();
+
+    //doc ids from best to worst, optionally with their scores
+    void getDocs(std::vector<int32_t> &docs, std::vector<float_t> *scores = NULL);
+
+ private:
+    struct ScoredDoc
+    {
+        int32_t doc;
+        float_t score;
+    };
+
+    //heap order, the worst hit sits on top
+    static bool better(const ScoredDoc &a, const ScoredDoc &b);
+
+    std::vector<ScoredDoc> heap;
+    int32_t                max_size;
+    int32_t                total_hits;
+};
+
+/**
+ *Keeps the best n hits ordered by a _sort field.
+ *
+ *Values come from lucene's FieldCache which holds them for as long as the
+ *reader is open, so repeated sorts over the same readers skip the term scan.
+ **/
+class SortedHitCollector : public lucene::search::HitCollector
+{
+ public:
+    SortedHitCollector(boost::shared_ptr<SharedMultiSearcher> searcher, const std::wstring &field,
+                       thrudex::SortType type, bool desc, int32_t n);
+
+    void collect(const int32_t doc, const float_t score);
+
+    int32_t getTotalHits();
+
+    void getDocs(std::vector<int32_t> &docs);
+
+    //loads (or finds) the cached values of a field for a reader
+    static lucene::search::FieldCacheAuto *loadField(lucene::index::IndexReader *reader, const TCHAR *field,
+                                                     thrudex::SortType type);
+
+ private:
+    struct SortedDoc
+    {
+        int32_t      doc;
+        int32_t      reader;
+        int32_t      ord;     ///< STRING: position in the reader's lookup table
+        const TCHAR *str;
+        int32_t      ival;
+        float_t      fval;
+    };
+
+    class Before
+    {
+     public:
+        Before(const SortedHitCollector *c) : c(c) {};
+
+        bool operator()(const SortedDoc &a, const SortedDoc &b) const
+        {
+            return c->before(a, b);
+        }
+
+     private:
+        const SortedHitCollector *c;
+    };
+
+    int32_t compare(const SortedDoc &a, const SortedDoc &b) const;
+    bool    before (const SortedDoc &a, const SortedDoc &b) const;
+
+    boost::shared_ptr<SharedMultiSearcher>       searcher;
+    thrudex::SortType                            type;
+    bool                                         desc;
+
+    std::vector<lucene::search::FieldCacheAuto*> values;  ///< one per reader, owned by the FieldCache
+
+    std::vector<SortedDoc>                       heap;
+    int32_t                                      max_size;
+    int32_t                                      total_hits;
+};
+
+/**
+ *Reservoir sample of n matching docs, used for randomized results
+ **/
+class RandomHitCollector : public lucene::search::HitCollector
+{
+ public:
+    RandomHitCollector(int32_t n);
+
+    void collect(const int32_t doc, const float_t score);
+
+    int32_t getTotalHits();
+
+    void getDocs(std::vector<int32_t> &docs);
+
+ private:
+    std::vector<int32_t> sample;
+    int32_t              max_size;
+    int32_t              total_hits;
+};
+
+/**
+ *Counts the values of KEYWORD fields over every matching doc, then hands
+ *the hit on to the collector doing the ranking.
+ *
+ *Counts are kept per reader by the ordinal in lucene's cached StringIndex
+ *of the field, values are only looked up once when the counts are read.
+ *A field with more than one value per doc can't be cached and is dropped.
+ **/
+class FacetCollector : public lucene::search::HitCollector
+{
+ public:
+    FacetCollector(boost::shared_ptr<SharedMultiSearcher> searcher, const std::vector<std::string> &fields);
+
+    //collector to hand hits to, returns the one to search with
+    lucene::search::HitCollector *wrap(lucene::search::HitCollector *collector);
+
+    void collect(const int32_t doc, const float_t score);
+
+    void getFacets(std::map<std::string, std::map<std::string, int32_t> > &facets);
+
+    //keeps the n most common values, ties go to the lower value
+    static void limitFacets(std::map<std::string, int32_t> &counts, int32_t n);
+
+ private:
+    struct Facet
+    {
+        std::string                                   field;
+        std::vector<lucene::search::FieldCacheAuto*>  values;  ///< one per reader, owned by the FieldCache
+        std::vector<std::vector<int32_t> >            counts;  ///< [reader][ord]
+    };
+
+    boost::shared_ptr<SharedMultiSearcher>  searcher;
+    std::vector<Facet>                      facets;
+    lucene::search::HitCollector           *collector;
+};
+
+#endif
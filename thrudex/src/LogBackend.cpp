@@ -101,6 +101,38 @@ string LogBackend::admin (const std::string & op, const std::string & data)
         file_logger->roll_log ();
         return "done";
     }
+    else if (op == "stats")
+    {
+        // read only, nothing to replay
+        return this->get_backend ()->admin (op, data);
+    }
+    else if (op == "snapshot")
+    {
+        // taken before the indexes sync, so everything logged before it
+        // is in the snapshot and a replica only replays what follows
+        string position = file_logger->get_log_position ();
+
+        string ret = this->get_backend ()->admin (op, data);
+
+        string state_file = data + "/thrudex.state";
+
+        boost::filesystem::ofstream outfile;
+        outfile.open (state_file.c_str (), ios::out | ios::binary | ios::trunc);
+
+        if (!outfile.is_open ())
+        {
+            ThrudexException e;
+            e.what = "can't write snapshot log position file=" + state_file;
+            T_ERROR (e.what.c_str ());
+            throw e;
+        }
+
+        outfile.write (position.data (), position.size ());
+        outfile.close ();
+
+        // the copy is local to this box, not something to replay
+        return ret;
+    }
     else
     {
         string ret = this->get_backend ()->admin (op, data);
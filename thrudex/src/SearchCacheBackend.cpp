@@ -0,0 +1,251 @@
+#ifdef HAVE_CONFIG_H
+#include "thrudex_config.h"
+#endif
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include "SearchCacheBackend.h"
+#include "CLuceneIndex.h"
+#include "ThruLogging.h"
+
+#include <concurrency/Util.h>
+
+#include <set>
+#include <stdio.h>
+
+using namespace boost;
+using namespace std;
+using namespace apache::thrift::concurrency;
+using namespace thrudex;
+
+//appends a field the key can't be confused by
+static void append_field(string &key, const string &value)
+{
+    char buf[32];
+    sprintf(buf, "%lu:", (unsigned long)value.size());
+
+    key += buf;
+    key += value;
+}
+
+static void append_field(string &key, int32_t value)
+{
+    char buf[32];
+    sprintf(buf, "%d;", value);
+
+    key += buf;
+}
+
+SearchCacheBackend::SearchCacheBackend(shared_ptr<ThrudexBackend> backend, unsigned int max_entries, unsigned int ttl)
+    : max_entries(max_entries), ttl(ttl), hits(0), misses(0)
+{
+    T_DEBUG( "SearchCacheBackend: max_entries=%u, ttl=%u", max_entries, ttl);
+
+    this->set_backend (backend);
+}
+
+string SearchCacheBackend::cacheKey(const SearchQuery &s)
+{
+    string key;
+
+    append_field(key, s.index);
+    append_field(key, s.query);
+    append_field(key, s.sortby);
+    append_field(key, s.limit);
+    append_field(key, s.offset);
+    append_field(key, s.desc ? 1 : 0);
+    append_field(key, s.payload ? 1 : 0);
+    append_field(key, (int32_t)s.sorttype);
+
+    append_field(key, (int32_t)s.facets.size());
+
+    for(size_t i=0; i<s.facets.size(); i++)
+        append_field(key, s.facets[i]);
+
+    append_field(key, s.facet_limit);
+
+    return key;
+}
+
+/**
+ *Caller must hold the mutex
+ **/
+int64_t SearchCacheBackend::generation(const string &index)
+{
+    map<string, int64_t>::iterator it = generations.find(index);
+
+    return it == generations.end() ? 0 : it->second;
+}
+
+void SearchCacheBackend::invalidate(const string &index)
+{
+    Guard g(mutex);
+
+    generations[index]++;
+    written[index] = Util::currentTime();
+}
+
+void SearchCacheBackend::search(const SearchQuery &s, SearchResponse &r)
+{
+    if(s.randomize || max_entries == 0){
+        this->get_backend ()->search (s, r);
+        return;
+    }
+
+    string  key = this->cacheKey(s);
+    int64_t gen;
+
+    {
+        Guard g(mutex);
+
+        gen = this->generation(s.index);
+
+        map<string, Entry>::iterator it = entries.find(key);
+
+        if(it != entries.end()){
+
+            if(it->second.generation == gen && it->second.expires > Util::currentTime()){
+                lru.splice(lru.begin(), lru, it->second.lru);
+                hits++;
+
+                r = it->second.response;
+                return;
+            }
+
+            //stale
+            lru.erase(it->second.lru);
+            entries.erase(it);
+        }
+
+        misses++;
+    }
+
+    //generation is read before searching so a write that lands during
+    //the search leaves this entry stale
+    this->get_backend ()->search (s, r);
+
+    //partial results aren't worth keeping
+    if(r.timed_out)
+        return;
+
+    int64_t refresh = read_index_config<int64_t>(s.index, "NRT_REFRESH_MS", NRT_REFRESH_MS_DEFAULT);
+
+    Guard g(mutex);
+
+    if(this->generation(s.index) != gen || entries.count(key))
+        return;
+
+    if(written.count(s.index) && Util::currentTime() - written[s.index] < refresh)
+        return;
+
+    while(!lru.empty() && entries.size() >= max_entries){
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+
+    lru.push_front(key);
+
+    Entry &e     = entries[key];
+    e.response   = r;
+    e.generation = gen;
+    e.expires    = Util::currentTime() + ttl;
+    e.lru        = lru.begin();
+}
+
+vector<SearchResponse> SearchCacheBackend::searchList(const vector<SearchQuery> &q)
+{
+    //run each query through search() above
+    return ThrudexBackend::searchList (q);
+}
+
+void SearchCacheBackend::put(const Document &d)
+{
+    try{
+        this->get_backend ()->put (d);
+    }catch(...){
+        this->invalidate(d.index);
+        throw;
+    }
+
+    this->invalidate(d.index);
+}
+
+void SearchCacheBackend::remove(const Element &e)
+{
+    try{
+        this->get_backend ()->remove (e);
+    }catch(...){
+        this->invalidate(e.index);
+        throw;
+    }
+
+    this->invalidate(e.index);
+}
+
+vector<ThrudexException> SearchCacheBackend::putList(const vector<Document> &documents)
+{
+    set<string> indexes;
+
+    for(size_t i=0; i<documents.size(); i++)
+        indexes.insert(documents[i].index);
+
+    vector<ThrudexException> ret;
+
+    try{
+        ret = this->get_backend ()->putList (documents);
+    }catch(...){
+        for(set<string>::iterator it=indexes.begin(); it!=indexes.end(); ++it)
+            this->invalidate(*it);
+        throw;
+    }
+
+    for(set<string>::iterator it=indexes.begin(); it!=indexes.end(); ++it)
+        this->invalidate(*it);
+
+    return ret;
+}
+
+vector<ThrudexException> SearchCacheBackend::removeList(const vector<Element> &elements)
+{
+    set<string> indexes;
+
+    for(size_t i=0; i<elements.size(); i++)
+        indexes.insert(elements[i].index);
+
+    vector<ThrudexException> ret;
+
+    try{
+        ret = this->get_backend ()->removeList (elements);
+    }catch(...){
+        for(set<string>::iterator it=indexes.begin(); it!=indexes.end(); ++it)
+            this->invalidate(*it);
+        throw;
+    }
+
+    for(set<string>::iterator it=indexes.begin(); it!=indexes.end(); ++it)
+        this->invalidate(*it);
+
+    return ret;
+}
+
+string SearchCacheBackend::admin(const string &op, const string &data)
+{
+    string ret = this->get_backend ()->admin (op, data);
+
+    if(op != "stats")
+        return ret;
+
+    char buf[1024];
+
+    {
+        Guard g(mutex);
+
+        sprintf(buf, "search_cache_entries=%lu,search_cache_hits=%llu,search_cache_misses=%llu",
+                (unsigned long)entries.size(), (unsigned long long)hits, (unsigned long long)misses);
+    }
+
+    if(ret.empty())
+        return string(buf);
+
+    return string(buf) + "\n" + ret;
+}
@@ -0,0 +1,67 @@
+#ifndef __SEARCH_CACHE_BACKEND_H__
+#define __SEARCH_CACHE_BACKEND_H__
+
+#include "ThrudexPassthruBackend.h"
+
+#include <concurrency/Mutex.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+/**
+ *Keeps recent search responses in a bounded LRU.
+ *
+ *An entry is served for at most SEARCH_CACHE_TTL_MS and only while its index
+ *hasn't been written to through this backend since it was cached. Randomized
+ *queries are never cached, nor are results from within an index's
+ *NRT_REFRESH_MS of a write since its searcher may not show the write yet.
+ **/
+class SearchCacheBackend : public ThrudexPassthruBackend
+{
+  public:
+    SearchCacheBackend(boost::shared_ptr<ThrudexBackend> backend, unsigned int max_entries, unsigned int ttl);
+
+    void put(const thrudex::Document &d);
+
+    void remove(const thrudex::Element &e);
+
+    void search(const thrudex::SearchQuery &s, thrudex::SearchResponse &r);
+
+    std::vector<thrudex::ThrudexException> putList(const std::vector<thrudex::Document> &documents);
+
+    std::vector<thrudex::ThrudexException> removeList(const std::vector<thrudex::Element> &elements);
+
+    std::vector<thrudex::SearchResponse> searchList(const std::vector<thrudex::SearchQuery> &q);
+
+    std::string admin(const std::string &op, const std::string &data);
+
+  private:
+
+    struct Entry
+    {
+        thrudex::SearchResponse          response;
+        int64_t                          generation;
+        int64_t                          expires;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::string cacheKey  (const thrudex::SearchQuery &s);
+    int64_t     generation(const std::string &index);
+    void        invalidate(const std::string &index);
+
+    apache::thrift::concurrency::Mutex  mutex;
+
+    std::map<std::string, Entry>        entries;
+    std::list<std::string>              lru;          ///< most recently used first
+    std::map<std::string, int64_t>      generations;  ///< bumped on every write to an index
+    std::map<std::string, int64_t>      written;      ///< time of the last write to an index
+
+    unsigned int                        max_entries;
+    unsigned int                        ttl;
+
+    uint64_t                            hits;
+    uint64_t                            misses;
+};
+
+#endif /* __SEARCH_CACHE_BACKEND_H__ */
@@ -31,12 +31,13 @@ SharedMultiSearcher::SharedMultiSearcher(boost::shared_ptr<lucene::store::FSDire
                                          boost::shared_ptr<lucene::index::IndexReader> disk_reader,
                                          boost::shared_ptr<lucene::search::IndexSearcher> disk_searcher,
                                          boost::shared_ptr<lucene::store::CLuceneRAMDirectory> ram_directory,
+                                         boost::shared_ptr<lucene::store::CLuceneRAMDirectory> buffer_directory,
                                          boost::shared_ptr<lucene::store::CLuceneRAMDirectory> prev_ram_directory)
     : disk_directory(disk_directory), disk_reader(disk_reader), disk_searcher(disk_searcher)
 {
 
-    //make a copy of the ram dir since its not thread safe
-    this->ram_directory = shared_ptr<CLuceneRAMDirectory>( new CLuceneRAMDirectory( ram_directory.get() ));
+    //snapshot the ram dir since the live one keeps changing, this only copies the file table
+    this->ram_directory = shared_ptr<CLuceneRAMDirectory>( ram_directory->snapshot() );
     this->ram_directory->__cl_addref(); //trick clucene's lame ref counters
 
     this->ram_reader = shared_ptr<IndexReader>( IndexReader::open(this->ram_directory.get(), true));
@@ -45,21 +46,44 @@ SharedMultiSearcher::SharedMultiSearcher(boost::shared_ptr<lucene::store::FSDire
     ram_searcher = shared_ptr<IndexSearcher>(new IndexSearcher( this->ram_reader.get() ));
 
 
+    //recently added docs not yet merged into the ram index
+    this->buffer_directory = shared_ptr<CLuceneRAMDirectory>( buffer_directory->snapshot() );
+    this->buffer_directory->__cl_addref(); //trick clucene's lame ref counters
+
+    this->buffer_reader = shared_ptr<IndexReader>( IndexReader::open(this->buffer_directory.get(), true));
+
+    buffer_searcher = shared_ptr<IndexSearcher>(new IndexSearcher( this->buffer_reader.get() ));
+
+
     searchables[0] = this->ram_searcher.get();
     searchables[1] = this->disk_searcher.get();
-    searchables[2] = NULL;
+    searchables[2] = this->buffer_searcher.get();
     searchables[3] = NULL;
+    searchables[4] = NULL;
+
+    readers[0]     = this->ram_reader.get();
+    readers[1]     = this->disk_reader.get();
+    readers[2]     = this->buffer_reader.get();
+    readers[3]     = NULL;
+    num_readers    = 3;
+
+    searchers[0]   = this->ram_searcher.get();
+    searchers[1]   = this->disk_searcher.get();
+    searchers[2]   = this->buffer_searcher.get();
+    searchers[3]   = NULL;
 
     if(prev_ram_directory.get() != NULL){
 
-        //make a copy of the ram dir since its not thread safe
-        this->prev_ram_directory = shared_ptr<CLuceneRAMDirectory>( new CLuceneRAMDirectory( prev_ram_directory.get() ));
+        this->prev_ram_directory = shared_ptr<CLuceneRAMDirectory>( prev_ram_directory->snapshot() );
         this->prev_ram_directory->__cl_addref(); //trick clucene's lame ref counters
 
         this->prev_ram_reader = shared_ptr<IndexReader>( IndexReader::open(this->prev_ram_directory.get(), true));
 
         prev_ram_searcher = shared_ptr<IndexSearcher>(new IndexSearcher( this->prev_ram_reader.get() ));
-        searchables[2] = this->prev_ram_searcher.get();
+        searchables[3] = this->prev_ram_searcher.get();
+        readers[3]     = this->prev_ram_reader.get();
+        searchers[3]   = this->prev_ram_searcher.get();
+        num_readers    = 4;
     }
 
 
@@ -79,6 +103,10 @@ SharedMultiSearcher::~SharedMultiSearcher()
         prev_ram_directory.reset();
     }
 
+    buffer_searcher.reset();
+    buffer_reader.reset();
+    buffer_directory.reset();
+
     ram_searcher.reset();
     ram_reader.reset();
     ram_directory.reset();
@@ -103,3 +131,96 @@ Hits *SharedMultiSearcher::search(Query *q, Filter *f, Sort *s)
 {
     return multi_searcher->search(q,f,s);
 }
+
+void SharedMultiSearcher::search(Query *q, Filter *f, HitCollector *c)
+{
+    multi_searcher->_search(q,f,c);
+}
+
+/**
+ *Same as MultiSearcher::_search but drives each scorer itself so it can
+ *stop between hits, doc numbers match the ones MultiSearcher hands out.
+ **/
+bool SharedMultiSearcher::search(Query *q, Filter *f, HitCollector *c, int64_t deadline)
+{
+    if(deadline <= 0){
+        multi_searcher->_search(q,f,c);
+        return true;
+    }
+
+    int32_t base = 0;
+
+    for(int32_t i=0; i<num_readers; i++){
+
+        //rewriting a wide wildcard can take a while by itself
+        if(Util::currentTime() >= deadline)
+            return false;
+
+        IndexReader *reader = readers[i];
+        BitSet      *bits   = f != NULL ? f->bits(reader) : NULL;
+        Weight      *weight = NULL;
+        Scorer      *scorer = NULL;
+        bool         done   = true;
+
+        try{
+
+            weight = q->weight(searchers[i]);
+            scorer = weight->scorer(reader);
+
+            int32_t n = 0;
+
+            while(scorer != NULL && scorer->next()){
+
+                int32_t d = scorer->doc();
+
+                if(bits == NULL || bits->get(d))
+                    c->collect(base + d, scorer->score());
+
+                //checking the clock on every hit costs more than the hit
+                if((++n & 255) == 0 && Util::currentTime() >= deadline){
+                    done = false;
+                    break;
+                }
+            }
+
+        } _CLFINALLY (
+            _CLDELETE(scorer);
+            _CLDELETE(weight);
+
+            if(bits != NULL && f->shouldDeleteBitSet(bits))
+                _CLDELETE(bits);
+        );
+
+        if(!done)
+            return false;
+
+        base += reader->maxDoc();
+    }
+
+    return true;
+}
+
+bool SharedMultiSearcher::doc(int32_t n, lucene::document::Document *d)
+{
+    return multi_searcher->doc(n,d);
+}
+
+int32_t SharedMultiSearcher::numReaders()
+{
+    return num_readers;
+}
+
+IndexReader *SharedMultiSearcher::getReader(int32_t i)
+{
+    return readers[i];
+}
+
+int32_t SharedMultiSearcher::subReader(int32_t n)
+{
+    return multi_searcher->subSearcher(n);
+}
+
+int32_t SharedMultiSearcher::subDoc(int32_t n)
+{
+    return multi_searcher->subDoc(n);
+}
@@ -21,6 +21,7 @@ class SharedMultiSearcher
                         boost::shared_ptr<lucene::index::IndexReader> disk_reader,
                         boost::shared_ptr<lucene::search::IndexSearcher> disk_searcher,
                         boost::shared_ptr<lucene::store::CLuceneRAMDirectory> ram_directory,
+                        boost::shared_ptr<lucene::store::CLuceneRAMDirectory> buffer_directory,
                         boost::shared_ptr<lucene::store::CLuceneRAMDirectory> prev_ram_directory = boost::shared_ptr<lucene::store::CLuceneRAMDirectory>());
 
     ~SharedMultiSearcher();
@@ -29,15 +30,35 @@ class SharedMultiSearcher
     lucene::search::Hits *search(lucene::search::Query *query, lucene::search::Filter *filter);
     lucene::search::Hits *search(lucene::search::Query *query, lucene::search::Filter *filter, lucene::search::Sort *sort);
 
+    void search(lucene::search::Query *query, lucene::search::Filter *filter, lucene::search::HitCollector *collector);
+
+    //stops collecting once deadline (Util::currentTime) passes, false if it did
+    bool search(lucene::search::Query *query, lucene::search::Filter *filter, lucene::search::HitCollector *collector,
+                int64_t deadline);
+
+    bool doc(int32_t n, lucene::document::Document *doc);
+
+    //maps a doc number from search() back to one of the underlying readers
+    int32_t                     numReaders();
+    lucene::index::IndexReader *getReader(int32_t i);
+    int32_t                     subReader(int32_t n);
+    int32_t                     subDoc(int32_t n);
+
  private:
     boost::shared_ptr<lucene::search::MultiSearcher>      multi_searcher;
-    lucene::search::Searchable                            *searchables[4];
+    lucene::search::Searchable                            *searchables[5];
+    lucene::index::IndexReader                            *readers[4];
+    lucene::search::IndexSearcher                         *searchers[4];
+    int32_t                                               num_readers;
 
     boost::shared_ptr<lucene::store::FSDirectory>         disk_directory;
     boost::shared_ptr<lucene::index::IndexReader>         disk_reader;
     boost::shared_ptr<lucene::search::IndexSearcher>      disk_searcher;
     boost::shared_ptr<lucene::store::CLuceneRAMDirectory> ram_directory;
     boost::shared_ptr<lucene::index::IndexReader>         ram_reader;
+    boost::shared_ptr<lucene::store::CLuceneRAMDirectory> buffer_directory;
+    boost::shared_ptr<lucene::index::IndexReader>         buffer_reader;
+    boost::shared_ptr<lucene::search::IndexSearcher>      buffer_searcher;
     boost::shared_ptr<lucene::store::CLuceneRAMDirectory> prev_ram_directory;
     boost::shared_ptr<lucene::index::IndexReader>         prev_ram_reader;
     boost::shared_ptr<lucene::search::IndexSearcher>      ram_searcher;
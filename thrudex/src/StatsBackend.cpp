@@ -71,6 +71,12 @@ string StatsBackend::admin(const string &op, const string &data)
              (long)getIndices_count, (long)put_count, (long)remove_count,
              (long)search_count, (long)putList_count, (long)removeList_count,
              (long)searchList_count, (long)admin_count);
+
+    // append whatever the backend knows about itself (index sizes etc.)
+    string backend_stats = this->get_backend ()->admin (op, data);
+    if (!backend_stats.empty ())
+      return string (buf) + "\n" + backend_stats;
+
     return string (buf);
   }
   ++admin_count;
@@ -18,6 +18,13 @@ enum FieldType
         UNSTORED = 3   #Analyzed text
 }
 
+enum SortType
+{
+        STRING   = 1,  #Compare values as strings
+        INT      = 2,  #Parse values as integers
+        FLOAT    = 3   #Parse values as floats
+}
+
 struct Field
 {
         1: string    key,
@@ -56,14 +63,23 @@ struct SearchQuery
 
         6: bool    desc      = 0,
         7: bool    randomize = 0,
-        8: bool    payload   = 0
+        8: bool    payload   = 0,
+
+        9: SortType sorttype = STRING,
+
+        10: i32    timeout_ms = 0,        #0 uses the index's SEARCH_TIMEOUT_MS
+
+        11: list<string> facets,          #KEYWORD fields to count the values of
+        12: i32    facet_limit = 0        #most common values returned per facet, 0 for all
 }
 
 struct SearchResponse
 {
         1: i32              total = -1,   #total across the entire index
         2: list<Element>    elements,
-        3: ThrudexException ex
+        3: ThrudexException ex,
+        4: bool             timed_out = 0, #deadline passed, total and elements are partial
+        5: map<string,map<string,i32>> facets  #field -> value -> matching docs
 }
 
 service Thrudex
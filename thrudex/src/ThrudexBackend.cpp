@@ -6,12 +6,117 @@
 
 #include "ThrudexBackend.h"
 #include "ThruLogging.h"
+#include "ConfigFile.h"
+
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <concurrency/Monitor.h>
+#include <concurrency/ThreadManager.h>
+#include <concurrency/PosixThreadFactory.h>
 
 using namespace std;
 using namespace boost;
+using namespace apache::thrift::concurrency;
 using namespace thrudex;
 
 
+/**
+ *Tracks one batch call. Lanes are handed out one at a time to the calling
+ *thread and whichever pool workers pick the batch up, so the caller always
+ *makes progress even when the pool is busy.
+ **/
+class BatchState
+{
+ public:
+    BatchState(boost::function<void (size_t)> work, size_t lanes)
+        : work(work), lanes(lanes), next(0), done(0) {};
+
+    void drain()
+    {
+        while(true){
+
+            size_t lane;
+
+            {
+                Synchronized s(monitor);
+
+                if(next >= lanes)
+                    return;
+
+                lane = next++;
+            }
+
+            work(lane);
+
+            {
+                Synchronized s(monitor);
+
+                if(++done == lanes)
+                    monitor.notifyAll();
+            }
+        }
+    }
+
+    void wait()
+    {
+        Synchronized s(monitor);
+
+        while(done < lanes)
+            monitor.wait();
+    }
+
+ private:
+    boost::function<void (size_t)> work;
+    const size_t            lanes;
+    size_t                  next;
+    size_t                  done;
+    Monitor                 monitor;
+};
+
+class BatchWorker : public Runnable
+{
+ public:
+    BatchWorker(shared_ptr<BatchState> state)
+        : state(state) {};
+
+    void run()
+    {
+        state->drain();
+    }
+
+ private:
+    shared_ptr<BatchState> state;
+};
+
+
+static Mutex                     batch_pool_mutex;
+static shared_ptr<ThreadManager> batch_pool;
+static int                       batch_concurrency = -1;
+
+/**
+ *The pool is shared by every backend, BATCH_THREAD_COUNT=0 disables it
+ **/
+static shared_ptr<ThreadManager> get_batch_pool()
+{
+    Guard g(batch_pool_mutex);
+
+    if(batch_concurrency < 0){
+
+        int thread_count  = ConfigManager->read<int>("BATCH_THREAD_COUNT",8);
+        batch_concurrency = ConfigManager->read<int>("BATCH_MAX_CONCURRENCY",4);
+
+        if(thread_count > 0){
+            batch_pool = ThreadManager::newSimpleThreadManager(thread_count);
+            batch_pool->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+            batch_pool->start();
+        }
+    }
+
+    return batch_pool;
+}
+
 
 ThrudexBackend::ThrudexBackend()
 {
@@ -23,28 +128,84 @@ ThrudexBackend::~ThrudexBackend()
 
 }
 
+void ThrudexBackend::runBatch(size_t lanes, boost::function<void (size_t)> work)
+{
+    shared_ptr<ThreadManager> pool = get_batch_pool();
+
+    if(lanes == 0)
+        return;
+
+    if(lanes == 1 || pool.get() == NULL || batch_concurrency <= 1){
+
+        for(size_t i=0; i<lanes; i++)
+            work(i);
+
+        return;
+    }
+
+    shared_ptr<BatchState> state(new BatchState(work, lanes));
+
+    //the calling thread is one of the workers
+    size_t helpers = lanes < (size_t)batch_concurrency ? lanes : (size_t)batch_concurrency;
+
+    for(size_t i=1; i<helpers; i++)
+        pool->add(shared_ptr<Runnable>(new BatchWorker(state)));
+
+    state->drain();
+    state->wait();
+}
+
 vector<ThrudexException> ThrudexBackend::putList(const vector<Document> &documents)
 {
+    ThrudexException         none;
+    vector<ThrudexException> exceptions(documents.size(), none);
 
-    vector<ThrudexException> exceptions;
-    ThrudexException none;
+    if(documents.empty())
+        return exceptions;
+
+    get_batch_pool();
+
+    size_t num_lanes = documents.size();
+
+    if(batch_concurrency > 0 && num_lanes > (size_t)batch_concurrency)
+        num_lanes = batch_concurrency;
+
+    //keep puts to the same key in order by giving them the same lane
+    vector<vector<size_t> > lanes(num_lanes);
+    boost::hash<string>     key_hash;
 
-    vector<Document>::const_iterator it;
+    for(size_t i=0; i<documents.size(); i++)
+        lanes[ key_hash(documents[i].index+"|"+documents[i].key) % num_lanes ].push_back(i);
 
-    for (it = documents.begin (); it != documents.end (); ++it)
+    this->runBatch(num_lanes, boost::bind(&ThrudexBackend::putLane, this, boost::cref(documents), boost::cref(lanes), boost::ref(exceptions), _1));
+
+    return exceptions;
+}
+
+void ThrudexBackend::putLane(const vector<Document> &documents, const vector<vector<size_t> > &lanes,
+                             vector<ThrudexException> &exceptions, size_t lane)
+{
+    vector<size_t>::const_iterator it;
+
+    for (it = lanes[lane].begin (); it != lanes[lane].end (); ++it)
     {
         try
         {
-            this->put( (*it) );
-            exceptions.push_back (none);
+            this->put( documents[*it] );
         }
         catch (ThrudexException e)
         {
-            exceptions.push_back (e);
+            exceptions[*it] = e;
+        }
+        catch (std::exception &e)
+        {
+            exceptions[*it].what = e.what ();
+        }
+        catch (...)
+        {
+            exceptions[*it].what = "Unknown error during put";
         }
     }
-
-    return exceptions;
 }
 
 vector<ThrudexException> ThrudexBackend::removeList(const vector<Element> &elements)
@@ -73,31 +234,45 @@ vector<ThrudexException> ThrudexBackend::removeList(const vector<Element> &eleme
 
 vector<SearchResponse> ThrudexBackend::searchList(const vector<SearchQuery> &queries)
 {
+    vector<SearchResponse> responses(queries.size());
 
-    vector<SearchResponse> responses;
+    //every query is its own lane, results land in request order
+    this->runBatch(queries.size(), boost::bind(&ThrudexBackend::searchItem, this, boost::cref(queries), boost::ref(responses), _1));
 
+    return responses;
+}
 
-    vector<SearchQuery>::const_iterator it;
+void ThrudexBackend::searchItem(const vector<SearchQuery> &queries, vector<SearchResponse> &responses,
+                                size_t i)
+{
+    try
+    {
+        this->search( queries[i], responses[i] );
+    }
+    catch (ThrudexException e)
+    {
+        SearchResponse r;
 
-    for(it = queries.begin (); it != queries.end (); ++it)
+        r.ex = e;
+
+        responses[i] = r;
+    }
+    catch (std::exception &e)
     {
-        try
-        {
-            SearchResponse r;
-            this->search( *it, r );
-            responses.push_back (r);
-        }
-        catch (ThrudexException e)
-        {
-            SearchResponse r;
+        SearchResponse r;
 
-            r.ex = e;
+        r.ex.what = e.what ();
 
-            responses.push_back(r);
-        }
+        responses[i] = r;
     }
+    catch (...)
+    {
+        SearchResponse r;
 
-    return responses;
+        r.ex.what = "Unknown error during search";
+
+        responses[i] = r;
+    }
 }
 
 string ThrudexBackend::admin (const string & op, const string & data)
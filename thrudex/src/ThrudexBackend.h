@@ -3,6 +3,8 @@
 
 #include "Thrudex.h"
 
+#include <boost/function.hpp>
+
 
 class ThrudexBackend
 {
@@ -26,6 +28,15 @@ class ThrudexBackend
 
     virtual std::string admin(const std::string &op, const std::string &data);
 
+    //Runs work(0..lanes-1) on the shared batch pool, returns when all are done
+    static void runBatch(size_t lanes, boost::function<void (size_t)> work);
+
+ private:
+
+    void putLane   (const std::vector<thrudex::Document> &documents, const std::vector<std::vector<size_t> > &lanes,
+                    std::vector<thrudex::ThrudexException> &exceptions, size_t lane);
+    void searchItem(const std::vector<thrudex::SearchQuery> &q, std::vector<thrudex::SearchResponse> &responses,
+                    size_t i);
 
 };
 
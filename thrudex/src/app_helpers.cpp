@@ -9,6 +9,7 @@
 #include "utils.h"
 #include "CLuceneBackend.h"
 #include "LogBackend.h"
+#include "SearchCacheBackend.h"
 #include "ThrudexBackend.h"
 
 #include <boost/shared_ptr.hpp>
@@ -27,6 +28,15 @@ shared_ptr<ThrudexBackend> create_backend (string /* which */,
 
     shared_ptr<ThrudexBackend> backend(new CLuceneBackend(index_root));
 
+    int cache_size = ConfigManager->read<int>("SEARCH_CACHE_SIZE", 1000);
+    if(cache_size > 0)
+    {
+        int cache_ttl = ConfigManager->read<int>("SEARCH_CACHE_TTL_MS", 2000);
+        backend = shared_ptr<ThrudexBackend> (new SearchCacheBackend (backend,
+                                                                      cache_size,
+                                                                      cache_ttl));
+    }
+
     // NOTE: logging should always be the outtermost backend
     string log_directory =
         ConfigManager->read<string>("LOG_DIRECTORY","");
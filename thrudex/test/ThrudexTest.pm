@@ -0,0 +1,207 @@
+#
+# Helpers for facet-test.pl, sort-test.pl and the other feature tests.
+# Each starts its own thrudex on a scratch INDEX_ROOT so it can set
+# config and restart it:
+#
+#   make && ./facet-test.pl
+#
+# Set THRUDEX to test a binary other than ../src/thrudex
+#
+
+package ThrudexTest;
+
+use strict;
+use warnings;
+
+use lib './gen-perl';
+
+use Thrift;
+use Thrift::BinaryProtocol;
+use Thrift::Socket;
+use Thrift::FramedTransport;
+
+use Data::Dumper;
+use Exporter;
+use File::Temp qw(tempdir);
+use Test::More;
+use Time::HiRes qw(sleep);
+use Thrudex::Thrudex;
+
+our @ISA    = qw(Exporter);
+our @EXPORT = qw(run_tests start_server stop_server client scratch_dir
+                 field doc search result_keys error_of stat_of);
+
+my $binary = $ENV{THRUDEX} || '../src/thrudex';
+my $port   = 9199;
+
+die "$binary isn't built\n" unless -x $binary;
+
+my $root = tempdir(CLEANUP => 1);
+
+my ($server, $transport, $client);
+
+#syncs quickly so a restart doesn't lose anything, writes are seen straight away
+my %defaults = (
+    THREAD_COUNT        => 5,
+    SERVER_PORT         => $port,
+    INDEX_ROOT          => "$root/index",
+    INDEX_LOAD_WAIT_MS  => 10000,
+    SYNC_MAX_AGE_MS     => 200,
+    NRT_MAX_DELAY_MS    => 100,
+    NRT_REFRESH_MS      => 0,
+    'log4j.rootLogger'  => 'WARN, A1',
+    'log4j.appender.A1' => 'org.apache.log4j.ConsoleAppender',
+    'log4j.appender.A1.layout' => 'org.apache.log4j.PatternLayout',
+    'log4j.appender.A1.layout.ConversionPattern' => '%-4r [%t] %-5p %c %x - %m%n',
+);
+
+sub scratch_dir
+{
+    return $root;
+}
+
+#any config given replaces the defaults for this run
+sub start_server
+{
+    my %conf = (%defaults, @_);
+
+    open(CONF,">$root/thrudex.conf") || die $!;
+    print CONF "$_=$conf{$_}\n" for (sort keys %conf);
+    close(CONF);
+
+    $server = fork();
+    die $! unless defined $server;
+
+    if($server == 0){
+        exec($binary, '-f', "$root/thrudex.conf") || die $!;
+    }
+
+    for(1..50){
+        my $socket = new Thrift::Socket('localhost',$port);
+        $transport = new Thrift::FramedTransport($socket);
+        $client    = new Thrudex::ThrudexClient(new Thrift::BinaryProtocol($transport));
+
+        eval{ $transport->open(); $client->ping(); };
+        return $client unless $@;
+
+        sleep(0.2);
+    }
+
+    die "thrudex didn't start";
+}
+
+sub stop_server
+{
+    return unless $server;
+
+    #let the ram indexes sync
+    sleep(1);
+
+    $transport->close();
+
+    kill('TERM', $server);
+    waitpid($server, 0);
+
+    $server = undef;
+}
+
+sub client
+{
+    return $client;
+}
+
+#starts a server with the config given, runs the tests and reports
+#anything they throw
+sub run_tests
+{
+    my ($conf, $tests) = @_;
+
+    start_server(%$conf);
+
+    eval{ $tests->() };
+
+    if($@){
+        fail("unexpected error");
+        diag(Dumper($@));
+    }
+
+    stop_server();
+
+    done_testing();
+}
+
+#field(key, value, type => Thrudex::FieldType::KEYWORD, sortable => 1)
+sub field
+{
+    my ($key, $value, %opt) = @_;
+
+    my $f = new Thrudex::Field();
+    $f->{key}   = $key;
+    $f->{value} = $value;
+    $f->{$_}    = $opt{$_} for (keys %opt);
+
+    return $f;
+}
+
+sub doc
+{
+    my ($index, $key, @fields) = @_;
+
+    my $d = new Thrudex::Document();
+    $d->{index}  = $index;
+    $d->{key}    = $key;
+    $d->{fields} = [@fields];
+
+    return $d;
+}
+
+#search(index, query, limit => 100, sortby => "price", ...)
+sub search
+{
+    my ($index, $query, %opt) = @_;
+
+    my $q = new Thrudex::SearchQuery();
+    $q->{index} = $index;
+    $q->{query} = $query;
+    $q->{$_}    = $opt{$_} for (keys %opt);
+
+    return $client->search($q);
+}
+
+sub result_keys
+{
+    my $r = shift;
+
+    return [map { $_->{key} } @{$r->{elements}}];
+}
+
+#returns the exception's message, or undef if the call didn't throw
+sub error_of
+{
+    my $sub = shift;
+
+    eval{ $sub->() };
+
+    return undef unless $@;
+
+    die Dumper($@) unless UNIVERSAL::isa($@, "Thrudex::ThrudexException");
+
+    return $@->{what};
+}
+
+#a number from admin("stats"), summed over every line that has it
+sub stat_of
+{
+    my ($name, $index) = @_;
+
+    my $stats = $client->admin("stats", defined $index ? $index : "");
+    my $total;
+
+    while($stats =~ /\b$name=(-?\d+)/g){
+        $total += $1;
+    }
+
+    return $total;
+}
+
+1;
@@ -0,0 +1,88 @@
+#!/usr/bin/perl
+
+#
+# Per index and per field analyzers picked by create_index
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+sub found
+{
+    my ($index, $query) = @_;
+
+    return search($index, $query)->{total};
+}
+
+run_tests({NGRAM_SIZE => 3}, sub {
+    is(client()->admin("create_index","skus|analyzer=keyword|field.title=standard|field.code=ngram"), "ok",
+       "created with options");
+    client()->admin("create_index","plain");
+    client()->admin("create_index","spaces|analyzer=whitespace");
+
+    foreach my $index ("skus","plain"){
+        client()->put( doc($index, "widget",
+                           field("sku",   "AB-123 X"),
+                           field("title", "The Blue Widget"),
+                           field("notes", "Blue notes"),
+                           field("code",  "XJ45910")) );
+    }
+
+    client()->put( doc("spaces", "widget", field("text", "Foo-Bar baz")) );
+
+    #keyword, the whole value is one term
+    is(found("skus",  'sku:"AB-123 X"'), 1, "keyword field matches the whole value");
+    is(found("skus",  'sku:x'),          0, "but not a word of it");
+    is(found("plain", 'sku:x'),          1, "a standard index splits it");
+    is(found("skus",  'notes:"Blue notes"'), 1, "keyword is the index default");
+    is(found("skus",  'notes:blue'),     0, "for fields without their own");
+
+    #standard, by field
+    is(found("skus",  'title:widget'),   1, "title is analyzed as standard");
+    is(found("skus",  'title:WIDGET'),   1, "lower cased");
+
+    #ngram, by field
+    is(found("skus",  'code:4591'),      1, "ngram matches part of a code");
+    is(found("skus",  'code:xj4'),       1, "lower cased");
+    is(found("skus",  'code:999'),       0, "but not what isn't there");
+    is(found("plain", 'code:4591'),      0, "a standard index only has the whole code");
+
+    #whitespace keeps case and punctuation
+    is(found("spaces", 'text:Foo-Bar'),  1, "whitespace splits on spaces only");
+    is(found("spaces", 'text:foo-bar'),  0, "and keeps case");
+
+    #options on an existing index change nothing
+    is(client()->admin("create_index","skus|analyzer=standard"), "ok", "existing index");
+    is(found("skus", 'sku:x'), 0, "keeps its analyzers");
+
+    #bad options create nothing
+    like(error_of(sub{ client()->admin("create_index","broken|analyzer=nope") }),
+         qr/Unknown analyzer/, "unknown analyzers are refused");
+    like(error_of(sub{ client()->admin("create_index","broken|field.a b=ngram") }),
+         qr/illegal chars/, "so are bad field names");
+    ok(!grep({ $_ eq "broken" } @{client()->getIndices()}), "without creating the index");
+    ok(!-e scratch_dir()."/index/broken.meta", "or leaving a meta file");
+
+    client()->admin("create_index","broken");
+    client()->put( doc("broken", "1", field("sku", "AB-123 X")) );
+    is(found("broken", 'sku:x'), 1, "created later without options it's standard");
+
+    #the analyzers are kept with the index
+    stop_server();
+    start_server(NGRAM_SIZE => 3);
+
+    is(found("skus",   'sku:"AB-123 X"'), 1, "keyword after a restart");
+    is(found("skus",   'sku:x'),          0, "still");
+    is(found("skus",   'code:4591'),      1, "ngram after a restart");
+    is(found("spaces", 'text:foo-bar'),   0, "whitespace after a restart");
+
+    #and with new docs, which are analyzed the same way
+    client()->put( doc("skus", "gadget", field("sku", "CD-456 Y"), field("code", "QQ77881")) );
+    is(found("skus", 'sku:"CD-456 Y"'), 1, "new docs use the keyword analyzer");
+    is(found("skus", 'code:778'),       1, "and the ngram one");
+});
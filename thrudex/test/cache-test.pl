@@ -0,0 +1,89 @@
+#!/usr/bin/perl
+
+#
+# Search result cache: repeated searches are hits, writes drop an
+# index's cached results, entries expire after SEARCH_CACHE_TTL_MS
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use Time::HiRes qw(sleep);
+use ThrudexTest;
+
+my $index = "cached";
+my $other = "uncached";
+
+sub counters
+{
+    return (stat_of("search_cache_hits"), stat_of("search_cache_misses"));
+}
+
+run_tests({SEARCH_CACHE_SIZE => 100, SEARCH_CACHE_TTL_MS => 60000}, sub {
+    client()->admin("create_index",$index);
+    client()->admin("create_index",$other);
+
+    client()->put( doc($index, "doc$_", field("text", "cached doc $_")) ) for (1..10);
+    client()->put( doc($other, "doc1", field("text", "other doc")) );
+
+    my ($hits, $misses) = counters();
+
+    my $r = search($index, "text:doc");
+    is($r->{total}, 10, "first search");
+
+    my $again = search($index, "text:doc");
+    is_deeply($again, $r, "repeat answered the same");
+    is_deeply([counters()], [$hits+1, $misses+1], "from the cache");
+
+    search($index, "text:doc", limit => 5);
+    is_deeply([counters()], [$hits+1, $misses+2], "a different page is a different entry");
+
+    search($index, "text:doc", randomize => 1) for (1..2);
+    is_deeply([counters()], [$hits+1, $misses+2], "random searches skip the cache");
+
+    #a write to another index leaves this one cached
+    search($other, "text:doc");
+    client()->put( doc($other, "doc2", field("text", "other doc")) );
+    search($index, "text:doc");
+    is_deeply([counters()], [$hits+2, $misses+3], "writes only drop their own index");
+
+    client()->put( doc($index, "doc11", field("text", "cached doc 11")) );
+
+    $r = search($index, "text:doc");
+    is($r->{total}, 11, "a put is seen straight away");
+    is_deeply([counters()], [$hits+2, $misses+4], "by missing the cache");
+
+    client()->remove( new Thrudex::Element({index => $index, key => "doc11"}) );
+    is(search($index, "text:doc")->{total}, 10, "so is a remove");
+
+    client()->putList([map { doc($index, "more$_", field("text", "more doc $_")) } (1..5)]);
+    is(search($index, "text:doc")->{total}, 15, "and a putList");
+
+    client()->removeList([map { new Thrudex::Element({index => $index, key => "more$_"}) } (1..5)]);
+    is(search($index, "text:doc")->{total}, 10, "and a removeList");
+
+    #entries expire
+    stop_server();
+    start_server(SEARCH_CACHE_SIZE => 100, SEARCH_CACHE_TTL_MS => 300);
+
+    search($index, "text:doc");
+    ($hits, $misses) = counters();
+
+    search($index, "text:doc");
+    is_deeply([counters()], [$hits+1, $misses], "hit within the ttl");
+
+    sleep(0.5);
+
+    search($index, "text:doc");
+    is_deeply([counters()], [$hits+1, $misses+1], "miss after it");
+
+    #turned off
+    stop_server();
+    start_server(SEARCH_CACHE_SIZE => 0);
+
+    search($index, "text:doc") for (1..2);
+    is(stat_of("search_cache_hits"), undef, "no cache with SEARCH_CACHE_SIZE=0");
+});
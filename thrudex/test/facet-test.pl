@@ -0,0 +1,61 @@
+#!/usr/bin/perl
+
+#
+# Facet counts over KEYWORD fields
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+my $index   = "facets";
+my %colors  = (red => 15, green => 10, blue => 5);
+my $keyword = Thrudex::FieldType::KEYWORD;
+
+run_tests({}, sub {
+    client()->admin("create_index",$index);
+
+    my $key = 0;
+
+    foreach my $color (sort keys %colors){
+        foreach my $i (1..$colors{$color}){
+            $key++;
+
+            client()->put( doc($index, "item$key",
+                               field("text",  "item number $key"),
+                               field("color", $color, type => $keyword),
+                               field("size",  ($key % 2 ? "small" : "large"), type => $keyword)) );
+        }
+    }
+
+    my $r = search($index, "text:item", facets => ["color"]);
+    is($r->{total}, 30, "every item matched");
+    is_deeply($r->{facets}, {color => \%colors}, "every color counted, not just the page");
+
+    $r = search($index, "text:item", facets => ["color","size"]);
+    is_deeply($r->{facets}->{size}, {small => 15, large => 15}, "two facets at once");
+
+    $r = search($index, "color:green", facets => ["color","size"]);
+    is_deeply($r->{facets}->{color}, {green => 10}, "counts only the matching docs");
+    is($r->{facets}->{size}->{small} + $r->{facets}->{size}->{large}, 10, "in every facet");
+
+    $r = search($index, "text:item", facets => ["color"], facet_limit => 2);
+    is_deeply($r->{facets}->{color}, {red => 15, green => 10}, "facet_limit keeps the most common values");
+
+    $r = search($index, "text:item");
+    ok(!$r->{facets} || !%{$r->{facets}}, "no facets unless asked for");
+
+    #removes show up in the next search's counts
+    foreach my $key (1..5){
+        client()->remove( new Thrudex::Element({index => $index, key => "item$key"}) );
+    }
+
+    $r = search($index, "text:item", facets => ["color"]);
+    is($r->{total}, 25, "removed");
+    is($r->{facets}->{color}->{blue}, undef, "blue items were the first five");
+    is($r->{facets}->{color}->{red}, 15, "others untouched");
+});
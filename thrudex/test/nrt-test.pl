@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+
+#
+# Searches reuse their view of an index for NRT_REFRESH_MS after a
+# change, then see every change made meanwhile at once
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use Time::HiRes qw(sleep);
+use ThrudexTest;
+
+my $index = "nrt";
+
+sub found
+{
+    my $query = shift;
+
+    return [sort @{result_keys( search($index, $query) )}];
+}
+
+#no sync or buffer merge during the test, a sync refreshes straight away
+run_tests({NRT_REFRESH_MS => 1000, NRT_MAX_DELAY_MS => 60000, SYNC_MAX_AGE_MS => 60000}, sub {
+    client()->admin("create_index",$index);
+
+    client()->put( doc($index, "doc1", field("text", "first version")) );
+
+    sleep(1.2);
+    is_deeply(found("text:first"), ["doc1"], "seen once the interval has passed");
+
+    #the search above refreshed, these land inside the interval
+    client()->put( doc($index, "doc2", field("text", "first version")) );
+    client()->put( doc($index, "doc2", field("text", "second version")) );
+    client()->put( doc($index, "doc1", field("text", "second version")) );
+
+    is_deeply(found("text:first"),  ["doc1"], "new docs and updates wait for the refresh");
+    is_deeply(found("text:second"), [],       "all of them");
+
+    sleep(1.2);
+    is_deeply(found("text:first"),  [],              "then show up together");
+    is_deeply(found("text:second"), ["doc1","doc2"], "with one copy of each doc");
+
+    #nothing stale was cached meanwhile
+    is_deeply(found("text:version"), ["doc1","doc2"], "every doc");
+    is_deeply(found("text:version"), ["doc1","doc2"], "and again from the cache");
+
+    client()->remove( new Thrudex::Element({index => $index, key => "doc2"}) );
+    is_deeply(found("text:version"), ["doc1","doc2"], "a remove waits too");
+
+    sleep(1.2);
+    is_deeply(found("text:version"), ["doc1"], "until the refresh");
+});
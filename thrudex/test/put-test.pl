@@ -0,0 +1,50 @@
+#!/usr/bin/perl
+
+#
+# put and putList report bad documents the same way on either side of
+# BULK_PUT_MIN_DOCS
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+my $index = "puts";
+
+sub batch
+{
+    my ($name, $size) = @_;
+
+    my @docs = map { doc($index, "$name$_", field("text", "$name doc $_")) } (1..$size);
+
+    $docs[10]->{key} = "";
+
+    return \@docs;
+}
+
+sub errors
+{
+    my $errors = shift;
+
+    return { map { $_ => $errors->[$_]->{what} } grep { defined $errors->[$_] && $errors->[$_]->{what} } (0..$#$errors) };
+}
+
+run_tests({BULK_PUT_MIN_DOCS => 100}, sub {
+    client()->admin("create_index",$index);
+
+    like(error_of(sub{ client()->put( doc($index, "", field("text", "no key")) ) }), qr/Missing key/,
+         "put reports a missing key");
+
+    is_deeply(errors( client()->putList(batch("small", 99)) ), {10 => "Missing key"},
+              "so does a putList below the bulk threshold");
+
+    is_deeply(errors( client()->putList(batch("bulk", 100)) ), {10 => "Missing key"},
+              "and one through the bulk path");
+
+    is(search($index, "text:small")->{total}, 98, "the rest of the small list went in");
+    is(search($index, "text:bulk")->{total},  99, "and of the bulk one");
+});
@@ -0,0 +1,79 @@
+#!/usr/bin/perl
+
+#
+# An index split into shards searches, sorts, facets and pages as one
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+my $index   = "sharded";
+my $keyword = Thrudex::FieldType::KEYWORD;
+
+sub item
+{
+    my $i = shift;
+
+    return doc($index, "item$i",
+               field("all",  "yes"),
+               field("even", ($i % 2 ? "no" : "yes"), type => $keyword),
+               field("num",  $i, type => $keyword, sortable => 1));
+}
+
+run_tests({"$index.SHARDS" => 4, BULK_PUT_MIN_DOCS => 100}, sub {
+    client()->admin("create_index",$index);
+
+    my @lines = grep { /^index=$index,shard\d+,/ } split(/\n/, client()->admin("stats",$index));
+    is(scalar(@lines), 4, "four shards");
+
+    #one at a time, then through the bulk path
+    client()->put( item($_) ) for (1..100);
+
+    my $errors = client()->putList([map { item($_) } (101..300)]);
+    ok(!grep({ defined $_ && $_->{what} } @$errors), "bulk put");
+
+    my $r = search($index, "all:yes");
+    is($r->{total}, 300, "every shard searched");
+
+    $r = search($index, "all:yes", sortby => "num", sorttype => Thrudex::SortType::INT, desc => 1);
+    is_deeply(result_keys($r), [map { "item$_" } reverse(291..300)], "shards merged in sort order");
+
+    $r = search($index, "all:yes", sortby => "num", sorttype => Thrudex::SortType::INT,
+                offset => 95, limit => 10);
+    is_deeply(result_keys($r), [map { "item$_" } (96..105)], "paging across shards");
+
+    $r = search($index, "all:yes", offset => 2147483000, limit => 1000);
+    is($r->{total}, 300, "a page past the end");
+    is_deeply(result_keys($r), [], "is empty, not an overflow");
+
+    $r = search($index, "all:yes", facets => ["even"]);
+    is_deeply($r->{facets}, {even => {yes => 150, no => 150}}, "facets summed across shards");
+
+    $r = search($index, "num:42");
+    is_deeply(result_keys($r), ["item42"], "a key is on one shard only");
+
+    client()->remove( new Thrudex::Element({index => $index, key => "item$_"}) ) for (1..50);
+
+    my $elements = [map { new Thrudex::Element({index => $index, key => "item$_"}) } (251..300)];
+    client()->removeList($elements);
+
+    $r = search($index, "all:yes", sortby => "num", sorttype => Thrudex::SortType::INT, limit => 1);
+    is($r->{total}, 200, "removed from every shard");
+    is_deeply(result_keys($r), ["item51"], "lowest left");
+
+    #shards on disk win over the config
+    stop_server();
+    start_server("$index.SHARDS" => 2);
+
+    @lines = grep { /^index=$index,shard\d+,/ } split(/\n/, client()->admin("stats",$index));
+    is(scalar(@lines), 4, "still four shards after a restart");
+
+    $r = search($index, "all:yes", sortby => "num", sorttype => Thrudex::SortType::INT, desc => 1, limit => 1);
+    is($r->{total}, 200, "every doc kept");
+    is_deeply(result_keys($r), ["item250"], "highest left");
+});
@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+
+#
+# admin("snapshot", dir) copies every index, sharded or not, with its
+# analyzers into a directory another thrudex can open as its INDEX_ROOT
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+my $backup = scratch_dir()."/backup";
+
+sub found
+{
+    my ($index, $query) = @_;
+
+    return search($index, $query)->{total};
+}
+
+run_tests({"split.SHARDS" => 3}, sub {
+    client()->admin("create_index","plain|field.code=ngram");
+    client()->admin("create_index","split");
+
+    client()->put( doc("plain", "doc$_", field("text", "before snapshot"), field("code", "XJ4591$_")) ) for (1..50);
+    client()->put( doc("split", "doc$_", field("text", "before snapshot")) ) for (1..90);
+
+    client()->remove( new Thrudex::Element({index => "plain", key => "doc1"}) );
+
+    like(error_of(sub{ client()->admin("snapshot","") }), qr/Missing/, "needs a directory");
+
+    #nothing is synced yet, the snapshot has to do it
+    is(client()->admin("snapshot",$backup), "done", "snapshot taken");
+
+    like(error_of(sub{ client()->admin("snapshot",$backup) }), qr/isn't empty/,
+         "won't write over an earlier one");
+
+    #writes after the snapshot carry on in the live index only
+    client()->put( doc("plain", "late", field("text", "after snapshot")) );
+    client()->remove( new Thrudex::Element({index => "split", key => "doc2"}) );
+
+    is(found("plain", "text:snapshot"), 50, "live index has the late doc");
+    is(found("split", "text:snapshot"), 89, "and the late remove");
+
+    stop_server();
+
+    #open the snapshot as if it were a replica
+    start_server(INDEX_ROOT => $backup);
+
+    is_deeply([sort @{client()->getIndices()}], ["plain","split"], "every index restored");
+
+    is(found("plain", "text:before"), 49, "docs as of the snapshot");
+    is(found("plain", "text:after"),  0,  "not the ones after");
+    is(found("split", "text:before"), 90, "across every shard");
+
+    my @lines = grep { /^index=split,shard\d+,/ } split(/\n/, client()->admin("stats","split"));
+    is(scalar(@lines), 3, "with the same shards");
+
+    is(found("plain", "code:4591"), 49, "and the same analyzers");
+
+    #the snapshot is a working index
+    client()->put( doc("plain", "new", field("text", "restored"), field("code", "QQ778")) );
+    is(found("plain", "code:778"), 1, "writable");
+});
@@ -0,0 +1,83 @@
+#!/usr/bin/perl
+
+#
+# Sorting by sortable fields as strings, ints and floats
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use List::Util qw(shuffle);
+use Test::More;
+use ThrudexTest;
+
+my $index = "sorting";
+
+my @ints   = (1..20);
+my @floats = map { $_ * 1.25 } (1..20);
+
+run_tests({}, sub {
+    client()->admin("create_index",$index);
+
+    #put in no particular order so doc ids don't give the answer away
+    foreach my $i (shuffle(0..$#ints)){
+        client()->put( doc($index, "doc$ints[$i]",
+                           field("all",   "yes"),
+                           field("num",   $ints[$i],   type => Thrudex::FieldType::KEYWORD, sortable => 1),
+                           field("price", $floats[$i], type => Thrudex::FieldType::KEYWORD, sortable => 1)) );
+    }
+
+    my @by_string = map { "doc$_" } sort { $a cmp $b } @ints;
+    my @by_int    = map { "doc$_" } sort { $a <=> $b } @ints;
+
+    my $r = search($index, "all:yes", sortby => "num", limit => 20,
+                   sorttype => Thrudex::SortType::STRING);
+    is_deeply(result_keys($r), \@by_string, "STRING compares the text");
+
+    $r = search($index, "all:yes", sortby => "num", limit => 20,
+                sorttype => Thrudex::SortType::INT);
+    is_deeply(result_keys($r), \@by_int, "INT compares numbers");
+
+    $r = search($index, "all:yes", sortby => "num", limit => 20, desc => 1,
+                sorttype => Thrudex::SortType::INT);
+    is_deeply(result_keys($r), [reverse @by_int], "desc");
+
+    #price rises with num, but as text 10 sorts before 2.5
+    $r = search($index, "all:yes", sortby => "price", limit => 20,
+                sorttype => Thrudex::SortType::FLOAT);
+    is_deeply(result_keys($r), \@by_int, "FLOAT compares numbers");
+
+    $r = search($index, "all:yes", sortby => "num", limit => 5, offset => 5,
+                sorttype => Thrudex::SortType::INT);
+    is_deeply(result_keys($r), [@by_int[5..9]], "offset and limit page through the sorted docs");
+    is($r->{total}, 20, "total counts every match");
+
+    $r = search($index, "all:yes", sortby => "num", limit => 3, desc => 1,
+                sorttype => Thrudex::SortType::INT);
+    is_deeply(result_keys($r), ["doc20","doc19","doc18"], "top of a short page");
+
+    #a new doc lands in the right place straight away
+    client()->put( doc($index, "doc0",
+                       field("all", "yes"),
+                       field("num", 0, type => Thrudex::FieldType::KEYWORD, sortable => 1)) );
+
+    $r = search($index, "all:yes", sortby => "num", limit => 2,
+                sorttype => Thrudex::SortType::INT);
+    is_deeply(result_keys($r), ["doc0","doc1"], "new docs are sorted in");
+
+    #the sort field doesn't exist, every doc has the same missing value
+    $r = search($index, "all:yes", sortby => "nothing", limit => 30);
+    is($r->{total}, 21, "unknown sort fields still find everything");
+
+    #a field that can't be sorted on is an error, not an unsorted page
+    client()->admin("create_index","multi");
+    client()->put( doc("multi", "doc1",
+                       field("all", "yes"),
+                       field("tag", "a", type => Thrudex::FieldType::KEYWORD, sortable => 1),
+                       field("tag", "b", type => Thrudex::FieldType::KEYWORD, sortable => 1)) );
+
+    like(error_of(sub{ search("multi", "all:yes", sortby => "tag") }), qr/Can't sort by tag/,
+         "more values than docs can't be sorted");
+});
@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+#
+# Search deadlines. How much a tiny deadline cuts off depends on the
+# machine, so those checks only run when the search actually timed out
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThrudexTest;
+
+my $docs = shift || 20000;
+
+run_tests({"strict.SEARCH_TIMEOUT_PARTIAL" => 0, SEARCH_CACHE_SIZE => 0}, sub {
+    foreach my $index ("partial","strict"){
+        client()->admin("create_index",$index);
+
+        for(my $i=0; $i<$docs; $i+=1000){
+            client()->putList([map { doc($index, "doc$_", field("text", "common word$_")) }
+                               ($i+1 .. ($i+1000 > $docs ? $docs : $i+1000))]);
+        }
+    }
+
+    my $r = search("partial", "text:common", timeout_ms => 60000);
+    is($r->{total}, $docs, "a generous deadline finds everything");
+    ok(!$r->{timed_out}, "and isn't flagged");
+
+    $r = search("partial", "text:common");
+    is($r->{total}, $docs, "no deadline by default");
+
+    #every doc matches, and the clauses take a while to parse and score
+    my $slow   = join(" ", "text:common", map { "text:word$_" } (1..500));
+    my $before = stat_of("timed_out", "partial");
+
+    $r = search("partial", $slow, timeout_ms => 1, limit => 10);
+
+    SKIP: {
+        skip("search finished inside 1ms", 3) unless $r->{timed_out};
+
+        ok($r->{total} < $docs, "partial results count what was collected");
+        ok(@{$r->{elements} || []} <= 10, "within the limit");
+        is(stat_of("timed_out", "partial"), $before + 1, "counted in stats");
+    }
+
+    my $error = error_of(sub{ search("strict", $slow, timeout_ms => 1) });
+
+    SKIP: {
+        skip("search finished inside 1ms", 1) unless defined $error;
+
+        like($error, qr/timed out/, "SEARCH_TIMEOUT_PARTIAL=0 makes it an error");
+    }
+
+    #the index default applies when the query doesn't set one
+    stop_server();
+    start_server("partial.SEARCH_TIMEOUT_MS" => 1, SEARCH_CACHE_SIZE => 0);
+
+    $r = search("partial", $slow);
+
+    SKIP: {
+        skip("search finished inside 1ms", 1) unless $r->{timed_out};
+
+        ok($r->{total} < $docs, "SEARCH_TIMEOUT_MS cuts searches short");
+    }
+
+    $r = search("partial", "text:common", timeout_ms => 60000);
+    is($r->{total}, $docs, "a query's own deadline overrides it");
+});
@@ -0,0 +1,1129 @@
+/**
+ * Copyright (c) 2007- T Jake Luciani
+ * Distributed under the New BSD Software License
+ *
+ * See accompanying file LICENSE or visit the Thrudb site at:
+ * http://thrudb.googlecode.com
+ *
+ **/
+#ifdef HAVE_CONFIG_H
+#include "thruqueue_config.h"
+#endif
+/* hack to work around thrift and log4cxx installing config.h's */
+#undef HAVE_CONFIG_H
+
+#include "ConsumerGroup.h"
+#include "Queue.h"
+#include "QueueManager.h"
+#include "ConfigFile.h"
+#include "utils.h"
+#include "QueueLog.h"
+#include "ThruLogging.h"
+
+#include <concurrency/Mutex.h>
+#include <concurrency/Exception.h>
+#include <concurrency/Util.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TTransportUtils.h>
+
+using namespace std;
+using namespace boost;
+using namespace apache::thrift;
+using namespace apache::thrift::concurrency;
+using namespace apache::thrift::transport;
+using namespace apache::thrift::protocol;
+using namespace thruqueue;
+
+
+
+/**
+ *
+ * The queue messages are read and locked while a worker is performing a task on the message.
+ * And when the task is completed sucessfully the worker must explicitly delete the message,
+ * otherwise it will be placed back on the group.
+ *
+ * Reads and deletes go to the group's journal, from which the read cursor
+ * and the outstanding leases can be rebuilt. Every journal starts with a
+ * snapshot of that state, so when one gets long a new one is started from
+ * what's in memory and the old one unlinked.
+ *
+ * On startup we replay the journals, then read the input log from the
+ * segment holding the oldest lease up to the cursor to get the leased
+ * messages back.
+ *
+ * A message id is its seq as 16 hex digits, the same in every group.
+ * Seqs keep counting across clearQueue, so an id is never handed out
+ * twice, and the id alone says which segment holds the message.
+ **/
+
+
+
+/**
+ *Rough footprint of a message held in memory
+ **/
+static int64_t message_bytes(const QueueInputMessage &m)
+{
+    return sizeof(QueueInputMessage) + m.message.size();
+}
+
+static string seq_to_id(uint64_t seq)
+{
+    char id[17];
+    sprintf(id,"%016llx",(unsigned long long)seq);
+
+    return string(id);
+}
+
+/**
+ *Anything that isn't an id we handed out is -1
+ **/
+static int64_t id_to_seq(const string &id)
+{
+    if(id.size() != 16)
+        return -1;
+
+    uint64_t seq = 0;
+
+    for(size_t i=0; i<id.size(); i++){
+        char c = id[i];
+
+        if(c >= '0' && c <= '9')
+            seq = (seq << 4) | (c - '0');
+        else if(c >= 'a' && c <= 'f')
+            seq = (seq << 4) | (c - 'a' + 10);
+        else
+            return -1;
+    }
+
+    //seqs never get that far
+    if((int64_t)seq < 0)
+        return -1;
+
+    return (int64_t)seq;
+}
+
+//map node and key on top of the message
+static const int64_t lease_overhead = 48;
+
+//a slot in the expiry heap, live or stale
+static const int64_t expiry_overhead = 16;
+
+//how far a group's bytes can drift from the server total before
+//account() publishes them, refills and batches publish on their own
+static const int64_t publish_bytes = 64*1024;
+
+
+/**
+ *Rebuilds the cursor and the leases from the journals
+ **/
+class JournalReplayer : virtual public QueueLogIf
+{
+public:
+    JournalReplayer(uint64_t cursor, map<uint64_t, QueueOutputMessage> &leases)
+        : cursor(cursor), leases(leases) {};
+
+    void log_send(const QueueInputMessage &m){
+
+    }
+
+    void log_read(const QueueOutputMessage &m){
+
+        if(m.seq < 0)
+            return;
+
+        if((uint64_t)m.seq + 1 > cursor)
+            cursor = m.seq + 1;
+
+        //read without a lease, it's gone
+        if(m.lock_time == 0)
+            leases.erase(m.seq);
+        else
+            leases[m.seq] = m;
+    }
+
+    void log_delete(const QueueOutputMessage &m){
+
+        if(m.seq >= 0)
+            leases.erase(m.seq);
+    }
+
+    void log_cursor(const QueueOutputMessage &m){
+
+        if(m.seq >= 0 && (uint64_t)m.seq > cursor)
+            cursor = m.seq;
+    }
+
+    uint64_t                           cursor;
+    map<uint64_t, QueueOutputMessage> &leases;
+};
+
+
+/**
+ *Fills in the bodies of spilled messages from a segment
+ **/
+class SpillLoader : virtual public QueueLogIf
+{
+public:
+    SpillLoader(uint64_t first_seq, map<uint64_t, QueueInputMessage *> &wanted)
+        : seq(first_seq), wanted(wanted), bytes(0) {};
+
+    void log_send(const QueueInputMessage &m){
+
+        map<uint64_t, QueueInputMessage *>::iterator it = wanted.find(seq++);
+
+        if(it == wanted.end())
+            return;
+
+        it->second->message = m.message;
+        bytes              += m.message.size();
+
+        wanted.erase(it);
+    }
+
+    void log_read(const QueueOutputMessage &m){
+
+    }
+
+    void log_delete(const QueueOutputMessage &m){
+
+    }
+
+    void log_cursor(const QueueOutputMessage &m){
+
+    }
+
+    uint64_t                            seq;
+    map<uint64_t, QueueInputMessage *> &wanted;
+    int64_t                             bytes;
+};
+
+
+/**
+ *This interface tails the log and adds messages to the group's buffer
+ *
+ **/
+class QueueLogReader : virtual public QueueLogIf
+{
+public:
+    QueueLogReader( ConsumerGroup *_group )
+        : group(_group) {};
+
+    void log_send(const QueueInputMessage &m ){
+        group->push_back(m);
+    }
+
+    void log_read(const QueueOutputMessage &m){
+
+    }
+
+    void log_delete(const QueueOutputMessage &m){
+
+    }
+
+    void log_cursor(const QueueOutputMessage &m){
+
+    }
+
+    ConsumerGroup *group;
+};
+
+
+ConsumerGroup::ConsumerGroup(Queue *queue, const string &name, uint64_t start, const vector<uint32_t> &journals)
+    : queue(queue), name(name), label(queue->queue_name), read_seq(0), read_segment(0), cursor(0),
+      journal_num(0), journal_records(0), journal_limit(100000), resident(0), unpublished(0), memory_limit(0), spilled(0),
+      max_read_wait(0), max_read_batch(0), removed(false), msg_buffer_size(200)
+{
+    if(!name.empty())
+        label += "/" + name;
+
+    msg_buffer_size    = ConfigManager->read<unsigned int>("QUEUE_BUFFER_SIZE", msg_buffer_size);
+
+    if(msg_buffer_size == 0)
+        msg_buffer_size = 1;
+
+    journal_limit      = ConfigManager->read<uint32_t>("QUEUE_JOURNAL_RECORDS", journal_limit);
+
+    memory_limit       = ConfigManager->read<int64_t>("QUEUE_MEMORY_LIMIT", 64*1024*1024);
+
+    max_read_wait      = ConfigManager->read<int32_t>("MAX_READ_WAIT_MS", 30000);
+
+    //one batch shouldn't drag the backlog past the memory limits
+    max_read_batch     = ConfigManager->read<int32_t>("MAX_READ_BATCH", (int32_t)msg_buffer_size);
+
+    if(max_read_batch < 1)
+        max_read_batch = 1;
+
+
+    //Create the faux log client
+    transport = boost::shared_ptr<TMemoryBuffer>(new TMemoryBuffer());
+    boost::shared_ptr<TProtocol>  p(new TBinaryProtocol(transport));
+    queue_log_client             = shared_ptr<QueueLogClient>(new QueueLogClient(p));
+
+    this->recover(start, journals);
+}
+
+ConsumerGroup::~ConsumerGroup()
+{
+    this->account(-resident);
+    this->publishResident();
+}
+
+string ConsumerGroup::journalFile(uint32_t num)
+{
+    char buf[32];
+    sprintf(buf,"%u",num);
+
+    if(name.empty())
+        return queue->doc_root + "/" + queue->queue_name + "_output." + buf + ".log";
+
+    return queue->doc_root + "/" + queue->queue_name + "_output." + name + "." + buf + ".log";
+}
+
+/**
+ *Replays the journals and reads the leased messages back. A new group
+ *starts on a fresh segment so there's nothing to read
+ **/
+void ConsumerGroup::recover(uint64_t start, const vector<uint32_t> &journals)
+{
+    shared_ptr<TProtocolFactory> pfactory(new TBinaryProtocolFactory());
+
+    //Replay the journals, oldest first
+    shared_ptr<JournalReplayer> jr(new JournalReplayer(start, recovered));
+
+    for(size_t i=0; i<journals.size(); i++){
+        shared_ptr<QueueLogProcessor> proc(new QueueLogProcessor(jr));
+        shared_ptr<TFileTransport>    log (new TFileTransport(this->journalFile(journals[i]),true));
+
+        TFileProcessor(proc,pfactory,log).process(0,false);
+    }
+
+    shared_ptr<TFileTransport> input_log;
+    uint64_t                   first;
+
+    {
+        Guard g(queue->send_mutex);
+
+        cursor    = jr->cursor > queue->sent ? queue->sent : jr->cursor;
+        input_log = queue->queue_input_log;
+
+        //Start reading from the segment with the oldest lease
+        uint64_t low = cursor;
+
+        if(!recovered.empty() && (uint64_t)recovered.begin()->first < low)
+            low = recovered.begin()->first;
+
+        first = queue->segments.front().first_seq;
+
+        for(size_t i=0; i<queue->segments.size(); i++)
+            if(queue->segments[i].first_seq <= low)
+                first = queue->segments[i].first_seq;
+    }
+
+    //everything up to the cursor has to be readable
+    input_log->flush();
+
+    this->openReader(first);
+
+    //catch up to the cursor, push_back keeps the leased messages
+    while(read_seq < cursor){
+
+        uint64_t segment_end;
+
+        {
+            Guard g(queue->send_mutex);
+            segment_end = queue->segmentEnd(read_segment);
+        }
+
+        uint64_t until = segment_end > 0 && segment_end < cursor ? segment_end : cursor;
+
+        if(read_seq < until)
+            queue_input_log_processor->process((uint32_t)(until - read_seq),false);
+
+        if(segment_end == 0 || until == cursor)
+            break;
+
+        if(read_seq != segment_end)
+            T_ERROR("%s: segment %llu is short %llu messages",label.c_str(),
+                    (unsigned long long)read_segment,(unsigned long long)(segment_end - read_seq));
+
+        this->openReader(segment_end);
+    }
+
+    if(read_seq != cursor){
+        T_ERROR("%s: input log ends at %llu but the cursor is at %llu",
+                label.c_str(),(unsigned long long)read_seq,(unsigned long long)cursor);
+
+        cursor = read_seq;
+    }
+
+    if(!recovered.empty()){
+        T_ERROR("%s: %d leased messages missing from the input log",label.c_str(),(int)recovered.size());
+        recovered.clear();
+    }
+
+
+    //A fresh journal with just the current state, the old ones can go
+    journal_num = journals.empty() ? 0 : journals.back() + 1;
+
+    this->startJournal(journal_num);
+    queue_output_log->flush();
+
+    for(size_t i=0; i<journals.size(); i++)
+        unlink(this->journalFile(journals[i]).c_str());
+
+    T_INFO("%s: cursor at %llu, %d leased",label.c_str(),(unsigned long long)cursor,(int)leases.size());
+}
+
+/**
+ *Points the log reader at the start of a segment, caller must hold the mutex
+ **/
+void ConsumerGroup::openReader(uint64_t first_seq)
+{
+    queue_input_log_reader       = shared_ptr<TFileTransport>(new TFileTransport(queue->segmentFile(first_seq),true) );
+    shared_ptr<TProtocolFactory>   pfactory(new TBinaryProtocolFactory());
+    shared_ptr<QueueLogReader>     qlr(new QueueLogReader(this));
+    shared_ptr<QueueLogProcessor>  proc    (new QueueLogProcessor(qlr));
+    queue_input_log_processor    = shared_ptr<TFileProcessor>(new TFileProcessor(proc,pfactory,queue_input_log_reader));
+
+    read_segment = first_seq;
+    read_seq     = first_seq;
+}
+
+/**
+ *Starts journal num with the cursor and a read record per lease, caller
+ *must hold the mutex
+ **/
+void ConsumerGroup::startJournal(uint32_t num)
+{
+    journal_num     = num;
+    journal_records = 0;
+
+    queue_output_log  = shared_ptr<TFileTransport>(new TFileTransport(this->journalFile(num)) );
+    queue_output_log->setFlushMaxUs(100);
+    queue_output_log->seekToEnd();
+
+    QueueOutputMessage c;
+    c.seq       = cursor;
+    c.timestamp = time(NULL);
+
+    queue_log_client->send_log_cursor(c);
+
+    int64_t  now = Util::currentTime();
+    uint32_t n   = 0;
+
+    for(map<uint64_t, Lease>::iterator it=leases.begin(); it!=leases.end(); ++it){
+
+        QueueOutputMessage m_log;
+        m_log.seq        = it->first;
+        m_log.timestamp  = (int32_t)(now / 1000);
+        m_log.lock_time  = (it->second.expires - now + 999) / 1000;
+
+        if(m_log.lock_time < 1)
+            m_log.lock_time = 1;
+
+        queue_log_client->send_log_read(m_log);
+
+        if(++n % 1000 == 0)
+            this->writeOutputLog();
+    }
+
+    //expired already, they come back expired
+    for(deque<QueueInputMessage>::iterator it=redeliver.begin(); it!=redeliver.end(); ++it){
+
+        QueueOutputMessage m_log;
+        m_log.seq        = it->seq;
+        m_log.timestamp  = 0;
+        m_log.lock_time  = 1;
+
+        queue_log_client->send_log_read(m_log);
+
+        if(++n % 1000 == 0)
+            this->writeOutputLog();
+    }
+
+    this->writeOutputLog();
+}
+
+/**
+ *Rewriting the journal from memory is O(leases), the old one only goes
+ *once the new one is on disk
+ **/
+uint64_t ConsumerGroup::prune()
+{
+    shared_ptr<TFileTransport> journal;
+    shared_ptr<TFileTransport> old_journal;
+    string                     old_journal_file;
+    uint64_t                   low;
+
+    {
+        Guard g(mutex);
+
+        this->expireLeases();
+
+        //nothing before this is needed anymore
+        low = cursor;
+
+        //leases are in seq order
+        if(!leases.empty() && leases.begin()->first < low)
+            low = leases.begin()->first;
+
+        for(deque<QueueInputMessage>::iterator it=redeliver.begin(); it!=redeliver.end(); ++it)
+            if((uint64_t)it->seq < low)
+                low = it->seq;
+
+        if(journal_records >= journal_limit && !removed){
+
+            T_DEBUG("%s: compacting journal %u",label.c_str(),journal_num);
+
+            old_journal      = queue_output_log;
+            old_journal_file = this->journalFile(journal_num);
+
+            this->startJournal(journal_num + 1);
+        }
+
+        journal = queue_output_log;
+    }
+
+    if(old_journal.get() != NULL){
+        journal->flush();
+        old_journal.reset();
+
+        unlink(old_journal_file.c_str());
+    }
+
+    return low;
+}
+
+/**
+ *Called by the log reader for every message, in log order
+ **/
+void ConsumerGroup::push_back(const thruqueue::QueueInputMessage &m)
+{
+    uint64_t seq = read_seq++;
+
+    QueueInputMessage msg = m;
+    msg.seq = seq;
+
+    if(seq >= cursor){
+        buffer.push_back(msg);
+        this->account(message_bytes(msg));
+        return;
+    }
+
+    //catching up on startup, only leased messages come back
+    map<uint64_t, QueueOutputMessage>::iterator it = recovered.find(seq);
+
+    if(it == recovered.end())
+        return;
+
+    int64_t expires = ((int64_t)it->second.timestamp + it->second.lock_time) * 1000;
+
+    recovered.erase(it);
+
+    if(expires <= Util::currentTime()){
+        redeliver.push_back(msg);
+        this->account(message_bytes(msg));
+    } else {
+        this->addLease(msg, expires);
+    }
+}
+
+/**
+ *Puts messages whose lease ran out back on the group, caller must hold the mutex
+ **/
+void ConsumerGroup::expireLeases()
+{
+    int64_t now = Util::currentTime();
+
+    while(!lease_expiry.empty() && lease_expiry.top().expires <= now){
+
+        LeaseExpiry e = lease_expiry.top();
+        lease_expiry.pop();
+
+        this->account(-expiry_overhead);
+
+        map<uint64_t, Lease>::iterator it = leases.find(e.seq);
+
+        //deleted, or leased again since
+        if(it == leases.end() || it->second.expires != e.expires)
+            continue;
+
+        T_DEBUG("%s: lease expired on %llu",label.c_str(),(unsigned long long)e.seq);
+
+        this->account(-lease_overhead);
+
+        redeliver.push_back(it->second.message);
+        leases.erase(it);
+    }
+}
+
+/**
+ *Caller must hold the mutex
+ **/
+void ConsumerGroup::addLease(const QueueInputMessage &m, int64_t expires)
+{
+    map<uint64_t, Lease>::iterator it = leases.find(m.seq);
+
+    //leased again after expiring
+    if(it != leases.end())
+        this->account(-message_bytes(it->second.message) - lease_overhead);
+    else
+        it = leases.insert(make_pair((uint64_t)m.seq, Lease())).first;
+
+    Lease &l  = it->second;
+
+    l.message = m;
+    l.expires = expires;
+
+    //it's still in its segment
+    if(this->overBudget() && !l.message.message.empty()){
+        l.message.message.clear();
+        spilled++;
+    }
+
+    this->account(message_bytes(l.message) + lease_overhead);
+
+    LeaseExpiry e;
+    e.expires    = l.expires;
+    e.seq        = m.seq;
+
+    lease_expiry.push(e);
+    this->account(expiry_overhead);
+
+    //the old entry is stale if it was leased again
+    this->compactLeaseExpiry();
+}
+
+/**
+ *Deleted and re-leased messages leave their heap entry behind until it
+ *would have expired, hours with a long lock_time. Past twice the live
+ *leases the heap is rebuilt from them, so each rebuild is paid for by as
+ *many stale entries. Caller must hold the mutex
+ **/
+void ConsumerGroup::compactLeaseExpiry()
+{
+    if(lease_expiry.size() <= 2 * leases.size() + 64)
+        return;
+
+    vector<LeaseExpiry> live;
+    live.reserve(leases.size());
+
+    for(map<uint64_t, Lease>::iterator it=leases.begin(); it!=leases.end(); ++it){
+        LeaseExpiry e;
+        e.expires = it->second.expires;
+        e.seq     = it->first;
+
+        live.push_back(e);
+    }
+
+    this->account(-(int64_t)(lease_expiry.size() - live.size()) * expiry_overhead);
+
+    lease_expiry = priority_queue<LeaseExpiry>(std::less<LeaseExpiry>(), live);
+}
+
+/**
+ *Takes the next message and leases it, the read record is left in the
+ *transport for the caller to write. Caller must hold the mutex
+ **/
+bool ConsumerGroup::nextMessage(const int32_t &lock_time, QueueMessage &result)
+{
+    if(redeliver.empty() && buffer.size() == 0)
+        this->bufferMessagesFromLog();
+
+    if(redeliver.empty() && buffer.size() == 0)
+        return false;
+
+    if(!redeliver.empty() && redeliver.front().message.empty())
+        this->reloadSpilled();
+
+    if(redeliver.empty() && buffer.size() == 0)
+        return false;
+
+    QueueInputMessage m;
+
+    if(!redeliver.empty()){
+        m = redeliver.front();
+        redeliver.pop_front();
+    } else {
+        m = buffer.front();
+        buffer.pop_front();
+
+        cursor = m.seq + 1;
+    }
+
+    this->account(-message_bytes(m));
+
+    if(lock_time > 0)
+        this->addLease(m, Util::currentTime() + (int64_t)lock_time * 1000);
+
+    QueueOutputMessage m_log;
+    m_log.seq             = m.seq;
+    m_log.timestamp       = time(NULL);
+    m_log.lock_time       = lock_time;
+
+    queue_log_client->send_log_read(m_log);
+    journal_records++;
+
+    result.message_id = seq_to_id(m.seq);
+    result.message    = m.message;
+
+    return true;
+}
+
+/**
+ *Drops the lease and leaves the delete record in the transport for the
+ *caller to write. Caller must hold the mutex
+ **/
+void ConsumerGroup::removeMessage(const string &message_id)
+{
+    int64_t seq   = id_to_seq(message_id);
+    bool    found = false;
+
+    if(seq < 0)
+        return;
+
+    map<uint64_t, Lease>::iterator it = leases.find(seq);
+
+    if(it != leases.end()){
+
+        this->account(-message_bytes(it->second.message) - lease_overhead);
+        leases.erase(it);
+        found = true;
+
+        this->compactLeaseExpiry();
+
+    } else {
+
+        //the lease ran out but the worker finished anyway
+        for(deque<QueueInputMessage>::iterator r=redeliver.begin(); r!=redeliver.end(); ++r){
+            if(r->seq == seq){
+                this->account(-message_bytes(*r));
+                redeliver.erase(r);
+                found = true;
+                break;
+            }
+        }
+    }
+
+    //not leased, nothing to record
+    if(!found)
+        return;
+
+    QueueOutputMessage m_log;
+    m_log.seq             = seq;
+    m_log.timestamp       = time(NULL);
+
+    queue_log_client->send_log_delete(m_log);
+    journal_records++;
+}
+
+/**
+ *Writes whatever read and delete records are in the transport as one event
+ **/
+void ConsumerGroup::writeOutputLog()
+{
+    string s = transport->getBufferAsString();
+    transport->resetBuffer();
+
+    if(s.empty())
+        return;
+
+    //write it to log
+    queue_output_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
+}
+
+static void check_lock_time(const int32_t &lock_time)
+{
+    if(lock_time < 0 || lock_time > 60*60*4){
+        ThruqueueException e;
+        e.code = INVALID_LOCK;
+        e.what = "A message lock cannot be greater than 4 hours";
+
+        throw e;
+    }
+}
+
+/**
+ *Holds one of the server wide slots for blocked readers
+ **/
+class ReadWaiter
+{
+ public:
+    ReadWaiter() : held(false) {}
+
+    ~ReadWaiter()
+    {
+        if(held)
+            QueueManager->releaseReadWaiter();
+    }
+
+    bool acquire()
+    {
+        if(!held)
+            held = QueueManager->reserveReadWaiter();
+
+        return held;
+    }
+
+ private:
+    bool held;
+};
+
+/**
+ *With wait_ms > 0 an empty group blocks until a message is sent, a lease
+ *expires or the wait runs out. Blocked readers hold a server worker so
+ *their number and wait are capped, past the cap reads don't wait
+ **/
+QueueMessage ConsumerGroup::readMessage(const int32_t &lock_time, const int32_t &wait_ms)
+{
+    check_lock_time(lock_time);
+
+    int32_t    wait     = wait_ms < max_read_wait ? wait_ms : max_read_wait;
+    int64_t    deadline = Util::currentTime() + (wait > 0 ? wait : 0);
+    ReadWaiter waiter;
+
+    while(true){
+
+        uint64_t seen;
+        int64_t  next_expiry = 0;
+
+        {
+            Synchronized s(queue->send_monitor);
+            seen = queue->send_count;
+        }
+
+        {
+            Guard g(mutex);
+
+            this->expireLeases();
+
+            QueueMessage result;
+
+            if(this->nextMessage(lock_time, result)){
+                this->writeOutputLog();
+                return result;
+            }
+
+            if(!lease_expiry.empty())
+                next_expiry = lease_expiry.top().expires;
+        }
+
+        int64_t now = Util::currentTime();
+
+        if(now >= deadline || !waiter.acquire())
+            break;
+
+        int64_t remaining = deadline - now;
+
+        //wake up for the next lease to run out too
+        if(next_expiry > 0 && next_expiry - now < remaining)
+            remaining = next_expiry - now > 0 ? next_expiry - now : 1;
+
+        Synchronized s(queue->send_monitor);
+
+        if(queue->send_count != seen)
+            continue;
+
+        try{
+            queue->send_monitor.wait(remaining);
+        }catch(TimedOutException &e){
+            //checked above
+        }
+    }
+
+    ThruqueueException e;
+    e.code = EMPTY_QUEUE;
+    e.what = "The queue is empty";
+
+    throw e;
+}
+
+/**
+ *Reads up to max messages (at most MAX_READ_BATCH), fewer (or none) if
+ *the group runs out
+ **/
+void ConsumerGroup::readMessageList(vector<QueueMessage> &_return, const int32_t &max, const int32_t &lock_time)
+{
+    check_lock_time(lock_time);
+
+    if(max <= 0){
+        ThruqueueException e;
+        e.code = INVALID_BATCH;
+        e.what = "max must be at least 1";
+
+        throw e;
+    }
+
+    int32_t want = max < max_read_batch ? max : max_read_batch;
+
+    Guard g(mutex);
+
+    this->expireLeases();
+
+    QueueMessage m;
+
+    while((int32_t)_return.size() < want && this->nextMessage(lock_time, m))
+        _return.push_back(m);
+
+    this->writeOutputLog();
+    this->publishResident();
+}
+
+void ConsumerGroup::deleteMessage(const std::string &message_id)
+{
+    Guard g(mutex);
+
+    this->removeMessage(message_id);
+    this->writeOutputLog();
+}
+
+void ConsumerGroup::deleteMessageList(const vector<string> &message_ids)
+{
+    Guard g(mutex);
+
+    for(size_t i=0; i<message_ids.size(); i++)
+        this->removeMessage(message_ids[i]);
+
+    this->writeOutputLog();
+    this->publishResident();
+}
+
+
+unsigned int ConsumerGroup::length()
+{
+    Guard g(mutex);
+
+    this->expireLeases();
+
+    Guard s(queue->send_mutex);
+
+    return (queue->sent - read_seq) + buffer.size() + redeliver.size();
+}
+
+/**
+ *Refills the empty buffer with the next batch from the input log in one
+ *pass, moving on to the next segment once the current one is read
+ **/
+void ConsumerGroup::bufferMessagesFromLog()
+{
+    if(buffer.size() > 0)
+        return;
+
+    shared_ptr<TFileTransport> input_log;
+    uint64_t                   unread;
+    uint64_t                   segment_end;
+
+    {
+        Guard g(queue->send_mutex);
+
+        unread      = queue->sent - read_seq;
+        input_log   = queue->queue_input_log;
+        segment_end = queue->segmentEnd(read_segment);
+    }
+
+    if(unread == 0)
+        return;
+
+    if(segment_end > 0 && read_seq >= segment_end){
+        this->openReader(segment_end);
+        this->bufferMessagesFromLog();
+        return;
+    }
+
+    T_DEBUG("%s: buffering new messages from log",label.c_str());
+
+    uint64_t left = segment_end > 0 ? segment_end - read_seq : unread;
+
+    unsigned int want = left > msg_buffer_size ? msg_buffer_size : (unsigned int)left;
+
+    //short on memory, the rest can wait in the log
+    if(this->overBudget())
+        want = 1;
+
+    queue_input_log_processor->process(want,false);
+
+    //a segment closed before startup has no writer to wait for, whatever
+    //is missing from it was lost
+    if(buffer.size() == 0 && segment_end > 0 && read_segment < queue->startup_segment){
+        T_ERROR("%s: segment %llu is short %llu messages",label.c_str(),
+                (unsigned long long)read_segment,(unsigned long long)left);
+
+        this->openReader(segment_end);
+        this->bufferMessagesFromLog();
+        return;
+    }
+
+    //Hmm, nada try flushing the log and reading again
+    if(buffer.size() == 0 && segment_end == 0){
+        input_log->flush();
+        queue_input_log_processor->process(want,false);
+
+        //flush() doesn't wait for events still being enqueued, they may
+        //land later. sent belongs to the producers, so just try again
+        //on the next read
+        if(buffer.size() == 0)
+            T_ERROR("%s: %d unread messages not in the log yet",label.c_str(),(int)unread);
+    }
+
+    this->publishResident();
+
+    T_DEBUG("%d %d",(int)buffer.size(), (int)unread);
+}
+
+/**
+ *Caller must hold the mutex, the queue has already started the new segment
+ **/
+void ConsumerGroup::reset(uint64_t start)
+{
+    this->openReader(start);
+    cursor = start;
+
+    //Clear eveything
+    buffer.clear();
+    redeliver.clear();
+    leases.clear();
+    lease_expiry = priority_queue<LeaseExpiry>();
+
+    this->account(-resident);
+    this->publishResident();
+
+    //the new journal has no leases, the old one can go
+    shared_ptr<TFileTransport> old_journal      = queue_output_log;
+    string                     old_journal_file = this->journalFile(journal_num);
+
+    this->startJournal(journal_num + 1);
+    queue_output_log->flush();
+
+    old_journal.reset();
+    unlink(old_journal_file.c_str());
+}
+
+/**
+ *Readers still holding on to the group write to the unlinked journal
+ **/
+void ConsumerGroup::remove()
+{
+    Guard g(mutex);
+
+    removed = true;
+
+    unlink(this->journalFile(journal_num).c_str());
+}
+
+/**
+ *Caller must hold the mutex
+ **/
+void ConsumerGroup::account(int64_t bytes)
+{
+    resident    += bytes;
+    unpublished += bytes;
+
+    if(unpublished >= publish_bytes || unpublished <= -publish_bytes)
+        this->publishResident();
+}
+
+/**
+ *Adds what account() has held back to the server total, caller must
+ *hold the mutex
+ **/
+void ConsumerGroup::publishResident()
+{
+    if(unpublished == 0)
+        return;
+
+    QueueManager->addResident(unpublished);
+    unpublished = 0;
+}
+
+bool ConsumerGroup::overBudget()
+{
+    return resident >= memory_limit || QueueManager->overMemoryLimit();
+}
+
+/**
+ *Reads the bodies of the next spilled redeliveries back from their
+ *segments, one pass per segment. Caller must hold the mutex
+ **/
+void ConsumerGroup::reloadSpilled()
+{
+    map<uint64_t, QueueInputMessage *> wanted;
+
+    for(deque<QueueInputMessage>::iterator it=redeliver.begin();
+        it!=redeliver.end() && wanted.size() < msg_buffer_size; ++it){
+
+        if(it->message.empty())
+            wanted[it->seq] = &(*it);
+    }
+
+    deque<Queue::Segment> l_segments;
+
+    {
+        Guard g(queue->send_mutex);
+        l_segments = queue->segments;
+    }
+
+    shared_ptr<TProtocolFactory> pfactory(new TBinaryProtocolFactory());
+
+    for(size_t i=0; i<l_segments.size() && !wanted.empty(); i++){
+
+        uint64_t first = l_segments[i].first_seq;
+        uint64_t end   = i+1 < l_segments.size() ? l_segments[i+1].first_seq : read_seq;
+
+        map<uint64_t, QueueInputMessage *>::iterator lo = wanted.lower_bound(first);
+        map<uint64_t, QueueInputMessage *>::iterator hi = wanted.lower_bound(end);
+
+        if(lo == hi)
+            continue;
+
+        uint64_t last = (--hi)->first;
+
+        shared_ptr<SpillLoader>       sl  (new SpillLoader(first, wanted));
+        shared_ptr<QueueLogProcessor> proc(new QueueLogProcessor(sl));
+        shared_ptr<TFileTransport>    log (new TFileTransport(l_segments[i].file,true));
+
+        TFileProcessor(proc,pfactory,log).process((uint32_t)(last - first + 1),false);
+
+        this->account(sl->bytes);
+    }
+
+    this->publishResident();
+
+    if(wanted.empty())
+        return;
+
+    T_ERROR("%s: %d spilled messages missing from the input log",label.c_str(),(int)wanted.size());
+
+    for(deque<QueueInputMessage>::iterator it=redeliver.begin(); it!=redeliver.end(); ){
+
+        if(wanted.count(it->seq)){
+            this->account(-message_bytes(*it));
+            it = redeliver.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+string ConsumerGroup::stats()
+{
+    Guard g(mutex);
+
+    this->expireLeases();
+
+    uint64_t length;
+    size_t   num_segments;
+
+    {
+        Guard s(queue->send_mutex);
+
+        length       = (queue->sent - read_seq) + buffer.size() + redeliver.size();
+        num_segments = queue->segments.size();
+    }
+
+    char buf[1024];
+    sprintf(buf, "%s: length=%llu,leased=%d,buffered=%d,resident_bytes=%lld,memory_limit=%lld,spilled=%llu,segments=%d",
+            label.c_str(), (unsigned long long)length, (int)leases.size(), (int)buffer.size(),
+            (long long)resident, (long long)memory_limit, (unsigned long long)spilled, (int)num_segments);
+
+    return string(buf);
+}
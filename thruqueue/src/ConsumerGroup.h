@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2007- T Jake Luciani
+ * Distributed under the New BSD Software License
+ *
+ * See accompanying file LICENSE or visit the Thrudb site at:
+ * http://thrudb.googlecode.com
+ *
+ **/
+
+
+#ifndef __CONSUMER_GROUP__H__
+#define __CONSUMER_GROUP__H__
+
+#include <map>
+#include <queue>
+#include <string>
+#include <deque>
+#include <vector>
+
+#include <concurrency/Mutex.h>
+#include <transport/TFileTransport.h>
+#include <transport/TTransportUtils.h>
+
+#include "Thruqueue.h"
+#include "Thruqueue_types.h"
+
+#include "QueueLog.h"
+
+class Queue;
+
+/**
+ *One reader of a queue's input log. Each group has its own read cursor,
+ *buffer, leases and journal (<queue>_output.<group>.<n>.log, or
+ *<queue>_output.<n>.log for the unnamed group), so every group sees
+ *every message sent.
+ *
+ *Messages handed out by readMessage are leased for lock_time seconds. A
+ *lease that runs out before the message is deleted puts the message back
+ *at the head of the group, checked whenever the group is read or measured.
+ *A lock_time of 0 takes the message without a lease.
+ **/
+class ConsumerGroup
+{
+ public:
+    //starts at seq start unless the journals say otherwise
+    ConsumerGroup(Queue *queue, const std::string &name, uint64_t start,
+                  const std::vector<uint32_t> &journals);
+    ~ConsumerGroup();
+
+    thruqueue::QueueMessage  readMessage(const int32_t &lock_time, const int32_t &wait_ms = 0);
+    void                     deleteMessage(const std::string &message_id);
+
+    //each batch is one log write under one lock
+    void                     readMessageList(std::vector<thruqueue::QueueMessage> &_return,
+                                             const int32_t &max, const int32_t &lock_time);
+    void                     deleteMessageList(const std::vector<std::string> &message_ids);
+
+    unsigned int length();
+    void         push_back(const thruqueue::QueueInputMessage &m);
+
+    //oldest seq the group still needs, rewrites a long journal
+    uint64_t     prune();
+
+    //drops everything and starts over at seq start, caller must hold
+    //the mutex and the queue's send_mutex
+    void         reset(uint64_t start);
+
+    //unlinks the journal once the group is gone
+    void         remove();
+
+    //length, leases and resident bytes
+    std::string  stats();
+
+ private:
+    friend class Queue;
+
+    void recover(uint64_t start, const std::vector<uint32_t> &journals);
+    void openReader(uint64_t first_seq);
+    void startJournal(uint32_t num);
+    std::string journalFile(uint32_t num);
+
+    void bufferMessagesFromLog();
+    void expireLeases();
+    void addLease(const thruqueue::QueueInputMessage &m, int64_t expires);
+    void compactLeaseExpiry();
+    bool nextMessage(const int32_t &lock_time, thruqueue::QueueMessage &result);
+    void removeMessage(const std::string &message_id);
+    void writeOutputLog();
+
+    void account(int64_t bytes);
+    void publishResident();
+    bool overBudget();
+    void reloadSpilled();
+
+
+    //covers everything below, taken before the queue's send_mutex
+    apache::thrift::concurrency::Mutex mutex;
+
+    Queue                             *queue;
+    std::string                        name;
+    std::string                        label;         ///< queue/group, for logs and stats
+
+    uint64_t                           read_seq;      ///< seq of the next message read from the log
+    uint64_t                           read_segment;  ///< first seq of the segment being read
+    uint64_t                           cursor;        ///< seq of the next message never handed out
+
+    uint32_t                           journal_num;
+    uint32_t                           journal_records;
+    uint32_t                           journal_limit;
+
+    //leases from the journal, only used while catching up on startup
+    std::map<uint64_t, thruqueue::QueueOutputMessage> recovered;
+
+    //Approximate bytes of the messages held below. Past QUEUE_MEMORY_LIMIT
+    //(or the server's limit) the buffer is refilled one message at a time
+    //and new leases drop the message body, which is read back from its
+    //segment if the lease expires. Sends are never empty so an empty body
+    //means spilled
+    int64_t                            resident;
+    int64_t                            unpublished;  ///< part of resident not yet in the server total
+    int64_t                            memory_limit;
+    uint64_t                           spilled;     ///< leases that dropped their body
+
+    int32_t                            max_read_wait;    ///< ms
+    int32_t                            max_read_batch;   ///< most messages per readMessageList
+    bool                               removed;          ///< deleted, don't start new journals
+
+    struct Lease
+    {
+        thruqueue::QueueInputMessage message;
+        int64_t                      expires;    ///< ms
+    };
+
+    struct LeaseExpiry
+    {
+        int64_t     expires;
+        uint64_t    seq;
+
+        //soonest on top of the priority_queue
+        bool operator<(const LeaseExpiry &o) const
+        {
+            return expires > o.expires;
+        }
+    };
+
+    //outstanding leases by seq, the heap may hold stale entries (counted
+    //in resident) until compactLeaseExpiry drops them
+    std::map<uint64_t, Lease>          leases;
+    std::priority_queue<LeaseExpiry>   lease_expiry;
+
+    //expired leases, delivered ahead of the buffer
+    std::deque<thruqueue::QueueInputMessage> redeliver;
+
+    //next unread messages from the input log, oldest first
+    std::deque<thruqueue::QueueInputMessage> buffer;
+
+
+    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_input_log_reader;
+    boost::shared_ptr<apache::thrift::transport::TFileProcessor> queue_input_log_processor;
+
+    //The journal of reads and deletes
+    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_output_log;
+
+    //serializer for the journal
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer>  transport;
+    boost::shared_ptr<thruqueue::QueueLogClient>                   queue_log_client;
+
+    unsigned int                msg_buffer_size;
+};
+
+#endif
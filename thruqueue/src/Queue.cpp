@@ -13,16 +13,22 @@
 #undef HAVE_CONFIG_H
 
 #include "Queue.h"
+#include "QueueManager.h"
 #include "ConfigFile.h"
 #include "utils.h"
 #include "QueueLog.h"
 #include "ThruLogging.h"
 
 #include <stdexcept>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
 
 #include <concurrency/ThreadManager.h>
 #include <concurrency/Mutex.h>
+#include <concurrency/Exception.h>
 #include <concurrency/PosixThreadFactory.h>
+#include <concurrency/Util.h>
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TTransportUtils.h>
 
@@ -38,596 +44,692 @@ using namespace thruqueue;
 
 /**
  *
- * A thruqueue is a series of messages logged to a thrift file transport.
- * This trasport is processed sequentially and has a
- * live compaction routine which runs to shrink the log.
- * The compaction routine can be configured to run based on the size of the processed log.
- *
- * Every log message contains the some standard info about the queue state
- * primarily to help speed up the compaction process.
+ * A thruqueue is a series of messages logged to thrift file transports.
  *
- * The queue messages are read and locked while a worker is performing a task on the message.
- * And when the task is completed sucessfully the worker must explicitly delete the message,
- * otherwise it will be placed back on the queue.
+ * Sends go to the input log, split into segments named after the seq of
+ * their first message (<queue>_input.<seq>.log). A segment is closed
+ * once it holds QUEUE_SEGMENT_MESSAGES messages, so a message's seq is
+ * just its position and never has to be written down.
  *
- * This means we need to track the outstanding read messages that have not been deleted and know what chunks they live in.
- * so we can propagate them to the next logfile during compaction. to do this we keep another log of reads and deletes.
+ * Every consumer group reads the segments with its own cursor and leases
+ * and keeps its own journal, see ConsumerGroup.cpp. Fanning a feed out
+ * to several consumers costs one write per message however many groups
+ * there are.
  *
- * Also, on startup we need to jump to the last known read position and, if compaction is required,
- * we write all the unread messages to the new log and build a list of the read but non-deleted
- * messages and their locations in the log.
+ * Compaction is O(live messages) and never stops the world: segments
+ * entirely behind every group's cursor and leases are unlinked, and long
+ * journals are rewritten from memory.
  *
- * last   read  chunk.
- * last   delete chunk.
- * last   send chunk.
- * last   compaction timestamp.
- * we know the current chunk of the log reader.
- * (encode the expire timestamp into the message_id!)
+ * On startup each group found on disk replays its journals. The unnamed
+ * group is always there unless it was deleted while named groups exist.
  **/
 
 
 
 /**
- *This is used to gather the latest queue stats from the tail of
- *the log. the tricky part here is starting back enough to capture the final message.
- *(i think) there is a chance this could fail if the final message is huge!
- *
+ *Counts the messages in a segment
  **/
-class PruneCollector : virtual public QueueLogIf
+class SegmentCounter : virtual public QueueLogIf
 {
 public:
-    PruneCollector() :
-        queue_length(-1),last_read_chunk(-1),last_timestamp(-1){};
+    SegmentCounter() : count(0) {};
 
     void log_send(const QueueInputMessage &m){
-        queue_length   = m.queue_length;
-        last_timestamp = m.timestamp;
+        count++;
     }
 
     void log_read(const QueueOutputMessage &m){
-        last_read_chunk = m.last_read_chunk;
-        last_read_id    = m.message_id;
+
     }
 
     void log_delete(const QueueOutputMessage &m){
 
-        if(m.timestamp > last_timestamp){
-            queue_length   = m.queue_length;
-            last_timestamp = m.timestamp;
-        }
-
     }
 
-    int32_t           queue_length;
-    int32_t           last_read_chunk;
-    std::string       last_read_id;
-    int32_t           last_timestamp;
-};
+    void log_cursor(const QueueOutputMessage &m){
 
+    }
 
+    uint64_t count;
+};
 
 
 /**
- * This class handles the copying of good messages to a new log.
- * it does this by calling a fake client to a memory buffer then
- * saving the string to the log.
- *
- * this handles is called from the log processor for queue inputs
- * and queue outputs.
+ *Reads the single input/output log pair older versions wrote, keeping
+ *the messages that were never deleted
  **/
-class PruneHandler : virtual public QueueLogIf
+class LegacyLogReader : virtual public QueueLogIf
 {
 public:
-    PruneHandler(shared_ptr<TFileTransport> _send_log, shared_ptr<TFileTransport> _read_log,
-                 apache::thrift::concurrency::Mutex &mutex) :
-        send_log(_send_log), read_log(_read_log), queue_length(0)
-    {
-        transport   = shared_ptr<TMemoryBuffer>(new TMemoryBuffer());
-        shared_ptr<TProtocol>      p(new TBinaryProtocol(transport));
-        faux_client = shared_ptr<QueueLogClient>(new QueueLogClient(p));
-    };
+    LegacyLogReader(Queue *_queue)
+        : queue(_queue) {};
 
+    void log_send(const QueueInputMessage &m){
 
-    void log_read(const QueueOutputMessage &m )
-    {
-        read_cache[m.message_id] = m;
-    }
+        if(consumed.count(m.message_id))
+            return;
 
-    void log_delete(const QueueOutputMessage &m )
-    {
+        pending.push_back(m.message);
 
-        if(read_cache.count(m.message_id)){
-            read_cache.erase(m.message_id);
-            delete_cache[m.message_id]++;
-        }
+        if(pending.size() >= 1000)
+            this->flush();
     }
 
-    void log_send(const QueueInputMessage &m )
-    {
-
-        //skip any messages that have been deleted
-        if(delete_cache.count(m.message_id))
-            return;
-
+    void log_read(const QueueOutputMessage &m){
 
-        //re-add messages that have expired
-        //otherwise keep them in the read log
-        if(read_cache.count(m.message_id)){
+        if(m.lock_time == 0)
+            consumed.insert(m.message_id);
+    }
 
-            QueueOutputMessage m_read = read_cache[m.message_id];
+    void log_delete(const QueueOutputMessage &m){
+        consumed.insert(m.message_id);
+    }
 
-            int32_t now = time(NULL);
-            if(now < m_read.timestamp + m_read.lock_time){
+    void log_cursor(const QueueOutputMessage &m){
 
-                faux_client->send_log_read(m_read);
-                string s = transport->getBufferAsString();
+    }
 
-                transport->resetBuffer();
+    void flush(){
+        queue->sendMessageList(pending);
+        pending.clear();
+    }
 
-                //write it to log
-                read_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
-            }
-        }
+    Queue          *queue;
+    set<string>     consumed;
+    vector<string>  pending;
+};
 
 
+Queue::Queue(const string name)
+    : sent(0), segment_size(100000), startup_segment(0), send_count(0), queue_name(name)
+{
+    doc_root           = ConfigManager->read<string>("DOC_ROOT");
 
-        faux_client->send_log_send(m);
-        string s = transport->getBufferAsString();
+    segment_size       = ConfigManager->read<unsigned int>("QUEUE_SEGMENT_MESSAGES", segment_size);
 
-        transport->resetBuffer();
+    if(segment_size == 0)
+        segment_size = 1;
 
-        //write it to log
-        send_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
-    }
+    if( !directory_exists(doc_root) )
+        throw std::runtime_error("DOC_ROOT is not valid (check config)");
 
+    this->recover();
+}
 
+/**
+ *Letters, digits, _ and -, since it ends up in file names
+ **/
+static bool valid_group_name(const string &group)
+{
+    if(group.empty())
+        return false;
 
-    shared_ptr<TFileTransport> send_log;
-    shared_ptr<TFileTransport> read_log;
-    shared_ptr<QueueLogClient> faux_client;
-    shared_ptr<TMemoryBuffer>  transport;
+    return group.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   "0123456789_-") == string::npos;
+}
 
-    //tracks messages that were read/deleted
-    map<string,QueueOutputMessage>  read_cache;
-    map<string,int>                 delete_cache;
+static bool is_number(const string &n)
+{
+    return !n.empty() && n.find_first_not_of("0123456789") == string::npos;
+}
 
-    unsigned int      queue_length;
-};
+string Queue::segmentFile(uint64_t first_seq)
+{
+    char buf[32];
+    sprintf(buf,"%llu",(unsigned long long)first_seq);
 
+    return doc_root + "/" + queue_name + "_input." + buf + ".log";
+}
 
 /**
- *This interface tails the log and adds messages to the in-memory queue
- *
+ *Finds the logs on disk and rebuilds the queue and its groups from them
  **/
-class QueueLogReader : virtual public QueueLogIf
+void Queue::recover()
 {
-public:
-    QueueLogReader( Queue *_queue )
-        : queue(_queue) {};
+    string input_prefix  = queue_name + "_input.";
+    string output_prefix = queue_name + "_output.";
 
-    void log_send(const QueueInputMessage &m ){
-        queue->push_back(m);
-    }
+    vector<uint64_t>                  seqs;
+    map<string, vector<uint32_t> >    journals;
 
-    void log_read(const QueueOutputMessage &m){
+    boost::filesystem::directory_iterator end;
 
-    }
+    for(boost::filesystem::directory_iterator i(doc_root); i != end; ++i){
 
-    void log_delete(const QueueOutputMessage &m){
+        string file = i->path().leaf();
+
+        if(file.size() < 4 || file.substr(file.size()-4) != ".log")
+            continue;
+
+        //the number is the only thing between prefix and .log
+        if(file.substr(0,input_prefix.size()) == input_prefix){
+            string n = file.substr(input_prefix.size(), file.size()-4-input_prefix.size());
+
+            if(is_number(n))
+                seqs.push_back(strtoull(n.c_str(),NULL,10));
 
+        } else if(file.substr(0,output_prefix.size()) == output_prefix){
+            string n = file.substr(output_prefix.size(), file.size()-4-output_prefix.size());
+
+            if(is_number(n)){
+                journals[""].push_back(strtoul(n.c_str(),NULL,10));
+                continue;
+            }
+
+            //<group>.<n>
+            size_t dot = n.rfind('.');
+
+            if(dot == string::npos || !valid_group_name(n.substr(0,dot)) || !is_number(n.substr(dot+1)))
+                continue;
+
+            journals[n.substr(0,dot)].push_back(strtoul(n.substr(dot+1).c_str(),NULL,10));
+        }
     }
 
-    Queue *queue;
-};
+    sort(seqs.begin(), seqs.end());
 
+    if(seqs.empty())
+        seqs.push_back(0);
 
-Queue::Queue(const string name)
-    : queue_name(name), queue_length(0), is_pruning(false), msg_buffer_size(200)
-{
-    string doc_root    = ConfigManager->read<string>("DOC_ROOT");
+    for(size_t i=0; i<seqs.size(); i++){
+        Segment s;
+        s.first_seq = seqs[i];
+        s.file      = this->segmentFile(seqs[i]);
 
-    if( !directory_exists(doc_root) )
-        throw std::runtime_error("DOC_ROOT is not valid (check config)");
+        segments.push_back(s);
+    }
+
+    shared_ptr<TProtocolFactory> pfactory(new TBinaryProtocolFactory());
 
-    queue_input_log_file  = doc_root + "/"+queue_name+"_input.log";
-    queue_output_log_file = doc_root + "/"+queue_name+"_output.log";
 
+    //Count what's in the segment we'll append to
+    {
+        shared_ptr<SegmentCounter>    counter(new SegmentCounter());
+        shared_ptr<QueueLogProcessor> proc   (new QueueLogProcessor(counter));
+        shared_ptr<TFileTransport>    log    (new TFileTransport(segments.back().file,true));
 
-    //Create the faux log client
-    transport = boost::shared_ptr<TMemoryBuffer>(new TMemoryBuffer());
-    boost::shared_ptr<TProtocol>  p(new TBinaryProtocol(transport));
-    queue_log_client             = shared_ptr<QueueLogClient>(new QueueLogClient(p));
+        TFileProcessor(proc,pfactory,log).process(0,false);
 
+        sent = segments.back().first_seq + counter->count;
+    }
 
-    //Create input log
-    queue_input_log  = shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file) );
+    queue_input_log  = shared_ptr<TFileTransport>(new TFileTransport(segments.back().file) );
     queue_input_log->setFlushMaxUs(100);
 
+    startup_segment = segments.back().first_seq;
 
-    //Create log processor to read from
-    queue_input_log_reader       = shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file,true) );
-    shared_ptr<TProtocolFactory>   pfactory(new TBinaryProtocolFactory());
-    shared_ptr<QueueLogReader>     qlr(new QueueLogReader(this));
-    shared_ptr<QueueLogProcessor>  proc    (new QueueLogProcessor(qlr));
-    queue_input_log_processor    = shared_ptr<TFileProcessor>(new TFileProcessor(proc,pfactory,queue_input_log_reader));
 
+    //a queue nobody has read yet only has the unnamed group
+    if(journals.empty())
+        journals[""] = vector<uint32_t>();
 
-    //Create output log
-    queue_output_log  = shared_ptr<TFileTransport>(new TFileTransport(queue_output_log_file) );
+    for(map<string, vector<uint32_t> >::iterator it=journals.begin(); it!=journals.end(); ++it){
 
-    queue_output_log->setFlushMaxUs(100);
-    queue_output_log->seekToEnd();
+        sort(it->second.begin(), it->second.end());
 
-    //check if compaction is required on startup
-    this->pruneLogFile();
-}
+        groups[it->first] = shared_ptr<ConsumerGroup>(
+            new ConsumerGroup(this, it->first, segments.front().first_seq, it->second));
+    }
 
 
+    this->convertLegacyLogs();
 
-void Queue::pruneLogFile()
+    T_INFO("%s: %d segments, %llu sent, %d groups",queue_name.c_str(),(int)segments.size(),
+           (unsigned long long)sent,(int)groups.size());
+}
+
+/**
+ *Queues written before segments existed are copied into the current
+ *segment once, messages that were read but not deleted become unread
+ **/
+void Queue::convertLegacyLogs()
 {
-    T_DEBUG("In pruneLogFile %s",queue_name.c_str());
+    string legacy_input_log  = doc_root + "/" + queue_name + "_input.log";
+    string legacy_output_log = doc_root + "/" + queue_name + "_output.log";
 
-    //another thread?
-    if(is_pruning)
+    if(!file_exists(legacy_input_log))
         return;
 
-    //First we replay the tail end of the queue log and collect last know reader position
-    shared_ptr<PruneCollector> pc(new PruneCollector());
-    try{
+    T_INFO("%s: converting old queue logs",queue_name.c_str());
 
+    shared_ptr<LegacyLogReader>   llr     (new LegacyLogReader(this));
+    shared_ptr<QueueLogProcessor> proc    (new QueueLogProcessor(llr));
+    shared_ptr<TProtocolFactory>  pfactory(new TBinaryProtocolFactory());
 
-        T_DEBUG("Finding location of last read");
-        {
-            Guard g(mutex);
-            queue_input_log->flush();
-            queue_output_log->flush();
-        }
+    if(file_exists(legacy_output_log)){
+        shared_ptr<TFileTransport> out_log(new TFileTransport(legacy_output_log,true));
+        TFileProcessor(proc,pfactory,out_log).process(0,false);
+    }
 
-        {
-            //init new log reader
-            shared_ptr<TFileTransport>           in_log( new TFileTransport(queue_input_log_file,true) );
-            shared_ptr<TFileTransport>           out_log( new TFileTransport(queue_output_log_file,true) );
-            shared_ptr<QueueLogProcessor>        proc( new QueueLogProcessor(pc));
-            shared_ptr<TProtocolFactory>         pfactory(new TBinaryProtocolFactory());
-
-            //No need to do anything
-            if(in_log->getNumChunks() < 1 && out_log->getNumChunks() < 1 && queue_length > 0 ) {
-                T_DEBUG("Log too small %d %d", in_log->getNumChunks(), out_log->getNumChunks()  );
-                return;
-            }
+    shared_ptr<TFileTransport> in_log(new TFileTransport(legacy_input_log,true));
+    TFileProcessor(proc,pfactory,in_log).process(0,false);
 
-            //just need the last few messages
-            in_log->seekToChunk( in_log->getNumChunks()-1 );
-            out_log->seekToChunk( out_log->getNumChunks()-1 );
+    llr->flush();
 
-            T_DEBUG("last chunk check: start");
+    {
+        Guard g(send_mutex);
+        queue_input_log->flush();
+    }
 
-            TFileProcessor input_fileProcessor(proc,pfactory,in_log);
-            TFileProcessor output_fileProcessor(proc,pfactory,out_log);
+    unlink(legacy_input_log.c_str());
+    unlink(legacy_output_log.c_str());
+}
 
-            input_fileProcessor.process(0,false);
-            output_fileProcessor.process(0,false);
+/**
+ *Starts a new segment at sent and returns the writer of the old one,
+ *caller must hold send_mutex and let it go (flushing it) after unlocking
+ **/
+shared_ptr<TFileTransport> Queue::rollSegment()
+{
+    Segment s;
+    s.first_seq = sent;
+    s.file      = this->segmentFile(sent);
 
-            T_DEBUG("last chunk check: end");
-        }
+    segments.push_back(s);
 
+    shared_ptr<TFileTransport> old = queue_input_log;
 
-        T_DEBUG("queue_len %d",pc->queue_length);
-        if(queue_length == 0 && pc->queue_length > 0){
-            queue_length = pc->queue_length;
-            T_DEBUG("queue_len %d",queue_length);
-        }
+    queue_input_log  = shared_ptr<TFileTransport>(new TFileTransport(s.file) );
+    queue_input_log->setFlushMaxUs(100);
 
-        //FIXME: make this a config var
-        if(pc->last_read_chunk < 10){
-            T_INFO("reader low on queue, no compaction required: %d", pc->last_read_chunk);
-            return;
-        }
+    T_DEBUG("%s: new segment %s",queue_name.c_str(),s.file.c_str());
 
-    }catch(TException e){
+    return old;
+}
 
-        T_ERROR("ex %s",e.what());
-        return;
-    }catch(...){
+/**
+ *First seq after the segment starting at first_seq, 0 if it's still being
+ *written. Caller must hold send_mutex
+ **/
+uint64_t Queue::segmentEnd(uint64_t first_seq)
+{
+    for(size_t i=0; i<segments.size(); i++)
+        if(segments[i].first_seq > first_seq)
+            return segments[i].first_seq;
 
-        perror("compaction failed big time");
-    }
+    return 0;
+}
 
+/**
+ *Every group's oldest live message bounds what can go
+ **/
+void Queue::pruneLogFile()
+{
+    T_DEBUG("In pruneLogFile %s",queue_name.c_str());
 
-    T_DEBUG("Compaction begun");
+    vector<shared_ptr<ConsumerGroup> > l_groups;
+    this->groupList(l_groups);
 
-    /////////////////////////////////////////////////
-    //Notify other threads that we are about to prune
-    //and start a new log
-    string backup_input_log;
-    string backup_output_log;
+    //with no groups nothing sent so far will be read, groups created
+    //later start past it
+    uint64_t low;
 
-    try{
-        Guard g(mutex);
-        is_pruning = true;
-        queue_input_log->flush();
-        queue_output_log->flush();
-        queue.clear();
+    {
+        Guard g(send_mutex);
+        low = sent;
+    }
 
-        //////////////////////////////
-        //backup the input old log
-        char buf[512];
-        sprintf(buf,".%d",(int)time(NULL));
-        backup_input_log  = queue_input_log_file + buf;
+    for(size_t i=0; i<l_groups.size(); i++){
+        uint64_t group_low = l_groups[i]->prune();
 
-        int rc = rename(queue_input_log_file.c_str(),backup_input_log.c_str());
-        assert(rc == 0); //FIXME: better have worked
+        if(group_low < low)
+            low = group_low;
+    }
 
-        //create new log and new reader
-        queue_input_log   =    shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file) );
-        queue_input_log->setFlushMaxUs(100);
 
-        //create log processor to read new messages from
-        queue_input_log_reader       = shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file,true) );
-        shared_ptr<QueueLogReader>     qlr ( new QueueLogReader(this));
-        shared_ptr<QueueLogProcessor>  proc( new QueueLogProcessor(qlr));
-        shared_ptr<TProtocolFactory>   pfactory(new TBinaryProtocolFactory());
-        queue_input_log_processor          = shared_ptr<TFileProcessor>(new TFileProcessor(proc,pfactory,queue_input_log_reader));
+    //segments nothing points into anymore
+    vector<string> consumed;
 
-        /////////////////////////////////
-        //backup the output log
-        backup_output_log = queue_output_log_file + buf;
-        rc = rename(queue_output_log_file.c_str(),backup_output_log.c_str());
-        assert(rc == 0); //FIXME: better have worked
+    {
+        Guard g(send_mutex);
 
-        //create new log and new reader
-        queue_output_log   =    shared_ptr<TFileTransport>(new TFileTransport(queue_output_log_file) );
-        queue_output_log->setFlushMaxUs(100);
+        while(segments.size() > 1 && segments[1].first_seq <= low){
+            consumed.push_back(segments.front().file);
+            segments.pop_front();
+        }
+    }
 
-    }catch(TException e){
+    for(size_t i=0; i<consumed.size(); i++){
+        T_DEBUG("%s: unlinking %s",queue_name.c_str(),consumed[i].c_str());
+        unlink(consumed[i].c_str());
+    }
 
-        T_ERROR("ex2 %s",e.what());
-        return;
-    }catch(...){
+    T_DEBUG("Exiting pruneLogFile()");
+}
 
-        perror("compaction failed big time");
-    }
+void Queue::createGroup(const string &group)
+{
+    if(!group.empty() && !valid_group_name(group)){
+        ThruqueueException e;
+        e.code = INVALID_QUEUE;
+        e.what = "invalid consumer group name: "+group;
 
-    T_DEBUG("Populating new log()");
+        throw e;
+    }
 
-    //Replay old log to create a new pruned log
+    //one create or delete at a time, readers only wait on group_mutex
+    //for the insert
+    Guard c(create_mutex);
 
+    {
+        Guard g(group_mutex);
 
-    //Log file to process
-    shared_ptr<TFileTransport>           in_log_old(new TFileTransport(backup_input_log,true) );
-    shared_ptr<TFileTransport>           out_log_old(new TFileTransport(backup_output_log,true) );
+        if( groups.count(group) > 0 )
+            return;
+    }
 
-    //start at old reader position
-    in_log_old->seekToChunk(pc->last_read_chunk);
+    uint64_t start;
 
-    //Prune handler does the work
-    shared_ptr<PruneHandler>             ph      (new PruneHandler(queue_input_log, queue_output_log, mutex));
-    shared_ptr<QueueLogProcessor>        proc    (new QueueLogProcessor(ph));
-    shared_ptr<TProtocolFactory>         pfactory(new TBinaryProtocolFactory());
+    {
+        //flushed when it goes out of scope, outside the lock
+        shared_ptr<TFileTransport> retired;
 
-    TFileProcessor output_fileProcessor(proc,pfactory,out_log_old);
-    TFileProcessor input_fileProcessor(proc,pfactory,in_log_old);
+        {
+            Guard s(send_mutex);
 
-    output_fileProcessor.process(0,false);
-    input_fileProcessor.process(0,false);
+            //the group starts on a segment boundary so it has nothing
+            //to read through to catch up
+            if(sent > segments.back().first_seq)
+                retired = this->rollSegment();
 
-    //Log file should be pruned. now lets populate our meta info
-    {
-        Guard g(mutex);
-        is_pruning = false;
-        T_DEBUG("Kept Unread Messages()");
-        this->queue_length = ph->queue_length;
+            start = sent;
+        }
     }
 
-    unlink(backup_input_log.c_str());
-    unlink(backup_output_log.c_str());
+    shared_ptr<ConsumerGroup> g_ptr(new ConsumerGroup(this, group, start, vector<uint32_t>()));
 
-    T_DEBUG("Exiting pruneLogFile()");
+    Guard g(group_mutex);
+    groups[group] = g_ptr;
 }
 
-void Queue::push_back(const thruqueue::QueueInputMessage &m)
+/**
+ *The group's place is lost, segments only it needed go on the next prune
+ **/
+void Queue::deleteGroup(const string &group)
 {
-    queue.push_back(m);
+    Guard c(create_mutex);
+
+    shared_ptr<ConsumerGroup> g_ptr;
+
+    {
+        Guard g(group_mutex);
+
+        map<string, shared_ptr<ConsumerGroup> >::iterator it = groups.find(group);
+
+        if(it == groups.end())
+            return;
+
+        g_ptr = it->second;
+        groups.erase(it);
+    }
+
+    g_ptr->remove();
 }
 
-void Queue::sendMessage(const string &mess)
+shared_ptr<ConsumerGroup> Queue::getGroup(const string &group)
 {
-    if(mess.empty())
-        return;
+    Guard g(group_mutex);
 
-    Guard g(mutex);
+    map<string, shared_ptr<ConsumerGroup> >::iterator it = groups.find(group);
 
-    QueueInputMessage m;
-    m.message_id = generateUUID();
-    m.message    = mess;
+    if(it != groups.end())
+        return it->second;
 
-    //mark the chunk this message will live in our log
-    m.chunk_pos = queue_input_log->getCurChunk();
-    m.queue_length = queue_length;
+    ThruqueueException e;
+    e.what = "consumer group not found: "+queue_name+"/"+group;
 
-    this->sendMessage(m);
+    throw e;
 }
 
-
-void Queue::sendMessage(const QueueInputMessage &m)
+/**
+ *Copies the groups out so they can be locked one at a time
+ **/
+void Queue::groupList(vector<shared_ptr<ConsumerGroup> > &l_groups)
 {
+    Guard g(group_mutex);
 
-    //This is called via log handler
-    //FIXME: should be private with friend
+    map<string, shared_ptr<ConsumerGroup> >::iterator it;
 
-    queue_log_client->send_log_send(m);
+    for(it=groups.begin(); it!=groups.end(); ++it)
+        l_groups.push_back(it->second);
+}
+
+void Queue::listGroups(vector<string> &names)
+{
+    Guard g(group_mutex);
 
-    string s = transport->getBufferAsString();
-    transport->resetBuffer();
+    map<string, shared_ptr<ConsumerGroup> >::iterator it;
 
-    //write it to log
-    queue_input_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
-    queue_length++;
+    for(it=groups.begin(); it!=groups.end(); ++it)
+        names.push_back(it->first);
 }
 
-QueueMessage Queue::readMessage(const int32_t &lock_time)
+/**
+ *Every group is locked for the duration, always in name order
+ **/
+void Queue::clear()
 {
-    if(lock_time < 0 || lock_time > 60*60*4){
-        ThruqueueException e;
-        e.code = INVALID_LOCK;
-        e.what = "A message lock cannot be greater than 4 hours";
-    }
+    //a group being created would start in a segment about to go
+    Guard c(create_mutex);
+    Guard g(group_mutex);
 
+    vector<shared_ptr<Guard> > held;
 
-    Guard g(mutex);
+    map<string, shared_ptr<ConsumerGroup> >::iterator it;
 
-    if(queue_length == 0){
+    for(it=groups.begin(); it!=groups.end(); ++it)
+        held.push_back(shared_ptr<Guard>(new Guard(it->second->mutex)));
 
-        ThruqueueException e;
-        e.code = EMPTY_QUEUE;
-        e.what = "The queue is empty";
+    uint64_t start;
 
-        throw e;
-    }
+    {
+        Guard s(send_mutex);
 
-    if(queue.size() == 0)
-        this->bufferMessagesFromLog();
+        queue_input_log->flush();
+        queue_input_log            = shared_ptr<TFileTransport>();
 
+        //delete the current logs
+        for(size_t i=0; i<segments.size(); i++)
+            unlink(segments[i].file.c_str());
 
-    QueueMessage result;
+        segments.clear();
 
-    if(queue.size() > 0){
+        //seqs keep counting up so old ids can't match new messages
+        Segment seg;
+        seg.first_seq = sent;
+        seg.file      = this->segmentFile(sent);
 
-        QueueInputMessage m =  queue[queue.size()-1];
-        queue.pop_back();
+        segments.push_back(seg);
 
-        QueueOutputMessage m_log;
-        m_log.message_id      = m.message_id;
-        m_log.lock_time       = lock_time;
-        m_log.last_read_chunk = m.chunk_pos;
+        queue_input_log        =    shared_ptr<TFileTransport>(new TFileTransport(seg.file) );
+        queue_input_log->setFlushMaxUs(100);
 
-        queue_log_client->send_log_read(m_log);
+        start     = sent;
+    }
 
-        string s = transport->getBufferAsString();
-        transport->resetBuffer();
+    for(it=groups.begin(); it!=groups.end(); ++it)
+        it->second->reset(start);
+}
 
-        //write it to log
-        queue_output_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
+string Queue::stats()
+{
+    vector<shared_ptr<ConsumerGroup> > l_groups;
+    this->groupList(l_groups);
 
-        result.message_id = m.message_id;
-        result.message    = m.message;
+    if(l_groups.empty()){
+        Guard s(send_mutex);
 
+        char buf[512];
+        sprintf(buf, "%s: groups=0,segments=%d", queue_name.c_str(), (int)segments.size());
 
-    } else {
+        return string(buf);
+    }
 
-        T_INFO("queue length is > 0 but queue appears empty");
+    string stats;
 
-        ThruqueueException e;
-        e.code = EMPTY_QUEUE;
-        e.what = "The queue is empty";
+    for(size_t i=0; i<l_groups.size(); i++){
 
-        throw e;
-    }
+        if(i > 0)
+            stats += "\n";
 
-    queue_length--;
+        stats += l_groups[i]->stats();
+    }
 
-    return result;
+    return stats;
 }
 
-void Queue::deleteMessage(const std::string &message_id)
+uint64_t Queue::logSize()
 {
-        QueueOutputMessage m_log;
-        m_log.message_id      = message_id;
-        m_log.timestamp       = time(NULL);
-
-        queue_log_client->send_log_delete(m_log);
+    vector<shared_ptr<ConsumerGroup> > l_groups;
+    this->groupList(l_groups);
 
-        string s = transport->getBufferAsString();
-        transport->resetBuffer();
+    uint64_t size = 0;
 
-        //write it to log
-        queue_output_log->write( (uint8_t *)s.c_str(), (uint32_t) s.length() );
-}
+    for(size_t i=0; i<l_groups.size(); i++){
+        Guard g(l_groups[i]->mutex);
+        size += l_groups[i]->journal_records;
+    }
 
+    Guard s(send_mutex);
 
-unsigned int Queue::length()
-{
-    Guard g(mutex);
-    return queue_length;
+    return size + (sent - segments.front().first_seq);
 }
 
-void Queue::bufferMessagesFromLog()
+uint64_t Queue::backlog()
 {
+    vector<shared_ptr<ConsumerGroup> > l_groups;
+    this->groupList(l_groups);
 
-    T_DEBUG("buffering new messages from log");
+    uint64_t most = 0;
 
-    if(queue.size() > 0)
-        return;
+    for(size_t i=0; i<l_groups.size(); i++){
+        uint64_t length = l_groups[i]->length();
 
-    if(queue_length == 0)
-        return;
-
-    //Buffer a set of new items into the queue from the log
-    if( queue_length <= msg_buffer_size ){
+        if(length > most)
+            most = length;
+    }
 
-        //There's enough to fill the buffer, load it all
-        queue_input_log_processor->process(queue_length,false);
+    return most;
+}
 
-        //Hmm, nada try flushing the log and reading again
-        if(queue.size() == 0)
-            queue_input_log->flush();
+/**
+ *Each producer call serializes into its own buffer, the shared client
+ *belongs to the read side. TFileTransport queues the write for its own
+ *writer thread so producers only hold send_mutex for the append
+ **/
+class SendSerializer
+{
+ public:
+    SendSerializer()
+        : buffer(new TMemoryBuffer()), bytes(0)
+    {
+        shared_ptr<TProtocol> p(new TBinaryProtocol(buffer));
+        client = shared_ptr<QueueLogClient>(new QueueLogClient(p));
+    }
 
-        queue_input_log_processor->process(queue_length,false);
+    void add(const QueueInputMessage &m)
+    {
+        client->send_log_send(m);
+        bytes += m.message.size();
+    }
 
-        T_DEBUG("%d %d",queue.size(), queue_length);
+    //an event can't span log chunks
+    bool full(uint32_t chunk_size)
+    {
+        return bytes > chunk_size / 2;
+    }
 
-    } else {
+    string take()
+    {
+        string s = buffer->getBufferAsString();
+        buffer->resetBuffer();
+        bytes = 0;
 
-        while(queue.size() < msg_buffer_size){
-            queue_input_log_processor->process(1,false);
-        }
+        return s;
     }
 
+ private:
+    shared_ptr<TMemoryBuffer>  buffer;
+    shared_ptr<QueueLogClient> client;
+    uint32_t                   bytes;
+};
+
+void Queue::sendMessage(const string &mess)
+{
+    if(mess.empty())
+        return;
+
+    this->sendMessageList(vector<string>(1, mess));
 }
 
-void Queue::clear()
+/**
+ *The whole batch goes to the input log as one write, serialized before
+ *taking send_mutex. A batch never spans segments
+ **/
+void Queue::sendMessageList(const vector<string> &messages)
 {
-    Guard g(mutex);
+    uint32_t chunk_size;
 
-    if(is_pruning){
-        ThruqueueException e;
-        e.what = BUSY_QUEUE;
-        e.what = "Clear failed because queue log is being pruned, try again in a few";
-        throw e;
+    {
+        Guard g(send_mutex);
+        chunk_size = queue_input_log->getChunkSize();
     }
 
-    queue_input_log->flush();
-    queue_input_log        =    shared_ptr<TFileTransport>();
+    //bigger than half a chunk goes out in pieces
+    vector<string> pieces;
+    SendSerializer ss;
+    unsigned int   n = 0;
 
-    //delete the current log
-    unlink(queue_input_log_file.c_str());
+    for(size_t i=0; i<messages.size(); i++){
 
-    //create a new log file
-    queue_input_log        =    shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file) );
-    queue_input_log->setFlushMaxUs(100);
+        if(messages[i].empty())
+            continue;
 
-    //create new log processor
-    queue_input_log_reader             = shared_ptr<TFileTransport>(new TFileTransport(queue_input_log_file,true) );
-    shared_ptr<TProtocolFactory>   pfactory(new TBinaryProtocolFactory());
-    shared_ptr<QueueLogReader>     qlr(new QueueLogReader(this));
-    shared_ptr<QueueLogProcessor>  proc    (new QueueLogProcessor(qlr));
-    queue_input_log_processor          = shared_ptr<TFileProcessor>(new TFileProcessor(proc,pfactory,queue_input_log_reader));
+        QueueInputMessage m;
+        m.message      = messages[i];
 
+        ss.add(m);
+        n++;
 
+        if(ss.full(chunk_size))
+            pieces.push_back(ss.take());
+    }
 
-    //////output
-    queue_output_log->flush();
-    queue_output_log        =    shared_ptr<TFileTransport>();
+    if(n == 0)
+        return;
 
-    //delete the current log
-    unlink(queue_output_log_file.c_str());
+    //the last message may have filled the previous piece already
+    string last = ss.take();
 
-    //create a new log file
-    queue_output_log        =    shared_ptr<TFileTransport>(new TFileTransport(queue_output_log_file) );
-    queue_output_log->setFlushMaxUs(100);
+    if(!last.empty())
+        pieces.push_back(last);
+
+    //flushed when it goes out of scope, outside the lock
+    shared_ptr<TFileTransport> retired;
+
+    {
+        Guard g(send_mutex);
+
+        if(sent - segments.back().first_seq >= segment_size)
+            retired = this->rollSegment();
+
+        for(size_t i=0; i<pieces.size(); i++)
+            queue_input_log->write( (uint8_t *)pieces[i].c_str(), (uint32_t) pieces[i].length() );
+
+        sent += n;
+    }
+
+    this->notifySend();
+}
+
+/**
+ *Wakes readers blocked in readMessage
+ **/
+void Queue::notifySend()
+{
+    Synchronized s(send_monitor);
 
-    //Clear eveything
-    queue_length = 0;
-    queue.clear();
+    send_count++;
+    send_monitor.notifyAll();
 }
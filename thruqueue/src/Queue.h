@@ -11,9 +11,11 @@
 #ifndef __QUEUE__H__
 #define __QUEUE__H__
 
+#include <map>
 #include <set>
 #include <string>
 #include <deque>
+#include <vector>
 
 #include <concurrency/Thread.h>
 #include <concurrency/Mutex.h>
@@ -26,59 +28,92 @@
 #include "Thruqueue_constants.h"
 
 #include "QueueLog.h"
+#include "ConsumerGroup.h"
 
 
+/**
+ *Sends are appended to input log segments, a message's seq is its
+ *position across all of them. Each consumer group reads the segments on
+ *its own and keeps its own journal of reads and deletes, the unnamed
+ *group "" is what readMessage uses by default. A segment is kept until
+ *every group is past it. See Queue.cpp
+ **/
 class Queue
 {
  public:
     Queue(const std::string name);
 
-    void                     sendMessage(const thruqueue::QueueInputMessage &mess);
     void                     sendMessage(const std::string &mess);
-    thruqueue::QueueMessage  readMessage(const int32_t &lock_time);
-    void                     deleteMessage(const std::string &message_id);
 
-    unsigned int length();
-    void         clear();
-    void         push_back(const thruqueue::QueueInputMessage &m);
+    //the whole batch is one log write
+    void                     sendMessageList(const std::vector<std::string> &messages);
 
-    void pruneLogFile();
- private:
-
-    void bufferMessagesFromLog();
+    //new groups start with the next message sent
+    void                     createGroup(const std::string &group);
+    void                     deleteGroup(const std::string &group);
+    boost::shared_ptr<ConsumerGroup> getGroup(const std::string &group);
+    void                     listGroups(std::vector<std::string> &names);
 
+    //empties every group
+    void         clear();
 
-    apache::thrift::concurrency::Mutex mutex;
+    //unlinks segments every group is done with, rewrites long journals
+    void pruneLogFile();
 
-    //message_id, expire_time
-    std::map<std::string, thruqueue::QueueOutputMessage> locked_messages;
+    //what pruneLogFile has to get through, messages in the segments plus
+    //journal records, and the most unread messages of any group
+    uint64_t logSize();
+    uint64_t backlog();
 
-    std::deque<thruqueue::QueueInputMessage> queue;
+    //a line per group
+    std::string stats();
+ private:
+    friend class ConsumerGroup;
 
+    struct Segment
+    {
+        uint64_t    first_seq;
+        std::string file;
+    };
 
+    void recover();
+    void convertLegacyLogs();
+    boost::shared_ptr<apache::thrift::transport::TFileTransport> rollSegment();
+    uint64_t segmentEnd(uint64_t first_seq);
+    std::string segmentFile(uint64_t first_seq);
+    void groupList(std::vector<boost::shared_ptr<ConsumerGroup> > &l_groups);
 
-    std::string             queue_name;
-    std::string             queue_input_log_file;
-    std::string             queue_output_log_file;
-    unsigned int            queue_length;
+    void notifySend();
 
 
-    bool is_pruning;
+    //guards the group map only, never held while taking a group's mutex
+    //except by clear()
+    apache::thrift::concurrency::Mutex group_mutex;
+    std::map<std::string, boost::shared_ptr<ConsumerGroup> > groups;
 
-    //A input log holds all send messages
-    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_input_log;
-    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_input_log_reader;
+    //serializes createGroup and deleteGroup, which would otherwise race
+    //on the same journal files. Taken before group_mutex
+    apache::thrift::concurrency::Mutex create_mutex;
 
-    //A output log holds all read and delete messages
-    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_output_log;
+    //Producers only take send_mutex, groups take it after their own
+    //mutex and briefly
+    apache::thrift::concurrency::Mutex send_mutex;
 
+    //oldest first, the last one is written to. send_mutex
+    std::deque<Segment>                segments;
+    uint64_t                           sent;          ///< seq of the next message sent, send_mutex, groups never change it
+    unsigned int                       segment_size;  ///< messages per segment
+    uint64_t                           startup_segment; ///< older segments were closed by a previous run
 
-    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer>  transport;
-    boost::shared_ptr<thruqueue::QueueLogClient>                   queue_log_client;
+    //readers waiting on an empty group, send_count guards against lost wakeups
+    apache::thrift::concurrency::Monitor send_monitor;
+    uint64_t                             send_count;
 
-    boost::shared_ptr<apache::thrift::transport::TFileProcessor> queue_input_log_processor;
+    std::string             queue_name;
+    std::string             doc_root;
 
-    unsigned int                msg_buffer_size;
+    //The input log segment being written, send_mutex
+    boost::shared_ptr<apache::thrift::transport::TFileTransport> queue_input_log;
 };
 
 #endif
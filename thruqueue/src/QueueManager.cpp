@@ -12,11 +12,14 @@
 #include "Thruqueue.h"
 #include "ConfigFile.h"
 #include "utils.h"
+#include "ThruLogging.h"
 #include <stdexcept>
+#include <algorithm>
 
 #include <concurrency/ThreadManager.h>
 #include <concurrency/Mutex.h>
 #include <concurrency/PosixThreadFactory.h>
+#include <concurrency/Util.h>
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TTransportUtils.h>
 
@@ -37,6 +40,40 @@ struct null_deleter
     void operator()(void const *) const {}
 };
 
+/**
+ *Prunes one queue on the maintenance pool
+ **/
+class QueueMaintainer : public Runnable
+{
+ public:
+    QueueMaintainer(const string &id, shared_ptr<Queue> queue)
+        : id(id), queue(queue) {};
+
+    void run()
+    {
+        QueueManager->maintainQueue(id, queue);
+    }
+
+ private:
+    const string      id;
+    shared_ptr<Queue> queue;
+};
+
+/**
+ *Biggest first
+ **/
+struct MaintenanceJob
+{
+    uint64_t          weight;
+    string            id;
+    shared_ptr<Queue> queue;
+
+    bool operator<(const MaintenanceJob &o) const
+    {
+        return weight > o.weight;
+    }
+};
+
 
 /**
  * The queue manager keeps tabs on the queues and makes sure they are being cleaned
@@ -77,22 +114,126 @@ void _QueueManager::startup()
     if( !directory_exists(doc_root) )
         throw std::runtime_error("DOC_ROOT is not valid (check config)");
 
+    //leave a worker free for everything else
+    int thread_count   = ConfigManager->read<int>("THREAD_COUNT", 5);
+    max_read_waiters   = ConfigManager->read<int>("MAX_READ_WAITERS", thread_count - 1);
+
+    {
+        Guard g(memory_mutex);
+
+        memory_limit = ConfigManager->read<int64_t>("SERVER_MEMORY_LIMIT", (int64_t)1024*1024*1024);
+        over_limit   = resident >= memory_limit;
+    }
+
+    compact_interval   = ConfigManager->read<int>("QUEUE_COMPACT_INTERVAL", compact_interval);
+
+    maintenance_pool   = ThreadManager::newSimpleThreadManager(ConfigManager->read<int>("MAINTENANCE_THREADS", 2));
+    maintenance_pool->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+    maintenance_pool->start();
+
     started = true;
 
 }
 
 void _QueueManager::run()
 {
-    map<string, shared_ptr<Queue> >::iterator it;
-
     while(true){
 
+        this->scheduleMaintenance();
+
+        sleep(1);
+    }
+}
+
+/**
+ *Hands the queues that are due to the pool, a slow one only ties up
+ *its own worker
+ **/
+void _QueueManager::scheduleMaintenance()
+{
+    vector<MaintenanceJob> jobs;
+
+    {
+        Guard g(mutex);
+
+        map<string, shared_ptr<Queue> >::iterator it;
+
         for(it=queue_cache.begin(); it!=queue_cache.end(); ++it){
-            it->second->pruneLogFile();
+            MaintenanceJob j;
+            j.weight = 0;
+            j.id     = it->first;
+            j.queue  = it->second;
+
+            jobs.push_back(j);
+        }
+    }
+
+    int64_t                now = Util::currentTime();
+    vector<MaintenanceJob> due;
+
+    {
+        Guard g(maintenance_mutex);
+
+        //forget deleted queues
+        set<string> ids;
+
+        for(size_t i=0; i<jobs.size(); i++)
+            ids.insert(jobs[i].id);
+
+        for(map<string, int64_t>::iterator it=next_maintenance.begin(); it!=next_maintenance.end(); ){
+            if(ids.count(it->first) == 0)
+                next_maintenance.erase(it++);
+            else
+                ++it;
+        }
+
+        for(size_t i=0; i<jobs.size(); i++){
+
+            if(maintaining.count(jobs[i].id))
+                continue;
+
+            map<string, int64_t>::iterator n = next_maintenance.find(jobs[i].id);
+
+            if(n != next_maintenance.end() && n->second > now)
+                continue;
+
+            due.push_back(jobs[i]);
+        }
+    }
+
+    if(due.empty())
+        return;
+
+    for(size_t i=0; i<due.size(); i++)
+        due[i].weight = due[i].queue->logSize() + due[i].queue->backlog();
+
+    sort(due.begin(), due.end());
+
+    for(size_t i=0; i<due.size(); i++){
+
+        int interval = ConfigManager->read<int>("QUEUE_COMPACT_INTERVAL_" + due[i].id, compact_interval);
+
+        {
+            Guard g(maintenance_mutex);
+
+            maintaining.insert(due[i].id);
+            next_maintenance[due[i].id] = now + (int64_t)interval * 1000;
         }
 
-        sleep(10);
+        maintenance_pool->add(shared_ptr<Runnable>(new QueueMaintainer(due[i].id, due[i].queue)));
+    }
+}
+
+void _QueueManager::maintainQueue( const string &id, shared_ptr<Queue> queue )
+{
+    try{
+        queue->pruneLogFile();
+    }catch(std::exception &e){
+        T_ERROR("%s: maintenance failed: %s",id.c_str(),e.what());
     }
+
+    Guard g(maintenance_mutex);
+    maintaining.erase(id);
 }
 
 
@@ -126,3 +267,84 @@ shared_ptr<Queue> _QueueManager::getQueue( const std::string &id )
 
     throw e;
 }
+
+bool _QueueManager::reserveReadWaiter()
+{
+    Guard g(waiter_mutex);
+
+    if(read_waiters >= max_read_waiters)
+        return false;
+
+    read_waiters++;
+
+    return true;
+}
+
+void _QueueManager::releaseReadWaiter()
+{
+    Guard g(waiter_mutex);
+
+    read_waiters--;
+}
+
+void _QueueManager::listQueues( vector<string> &names )
+{
+    Guard g(mutex);
+
+    map<string, shared_ptr<Queue> >::iterator it;
+
+    for(it=queue_cache.begin(); it!=queue_cache.end(); ++it)
+        names.push_back(it->first);
+}
+
+void _QueueManager::addResident(int64_t bytes)
+{
+    Guard g(memory_mutex);
+
+    resident  += bytes;
+    over_limit = resident >= memory_limit;
+}
+
+/**
+ *Read on every refill and lease, a stale answer only means one more
+ *message buffered or one less spilled
+ **/
+bool _QueueManager::overMemoryLimit()
+{
+    return over_limit;
+}
+
+string _QueueManager::stats( const string &id )
+{
+    vector<shared_ptr<Queue> > queues;
+
+    {
+        Guard g(mutex);
+
+        map<string, shared_ptr<Queue> >::iterator it;
+
+        for(it=queue_cache.begin(); it!=queue_cache.end(); ++it){
+
+            //optionally limit to a single queue
+            if(!id.empty() && id != it->first)
+                continue;
+
+            queues.push_back(it->second);
+        }
+    }
+
+    string stats;
+
+    for(size_t i=0; i<queues.size(); i++)
+        stats += queues[i]->stats() + "\n";
+
+    char buf[256];
+
+    {
+        Guard g(memory_mutex);
+
+        sprintf(buf, "server: resident_bytes=%lld,memory_limit=%lld", (long long)resident, (long long)memory_limit);
+    }
+
+    return stats + buf;
+}
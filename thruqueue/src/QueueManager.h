@@ -10,12 +10,15 @@
 #ifndef __QUEUE_MANAGER__
 #define __QUEUE_MANAGER__
 
+#include <map>
+#include <set>
 #include <string>
 #include <boost/shared_ptr.hpp>
 #include <concurrency/Thread.h>
 #include <concurrency/Mutex.h>
 #include <concurrency/Monitor.h>
 #include <concurrency/PosixThreadFactory.h>
+#include <concurrency/ThreadManager.h>
 
 #include "Queue.h"
 
@@ -32,17 +35,54 @@ class _QueueManager : public apache::thrift::concurrency::Runnable
     void   deleteQueue( const std::string &id );
     boost::shared_ptr<Queue> getQueue( const std::string &id );
 
+    void   listQueues( std::vector<std::string> &names );
+
+    //caps the worker threads tied up by blocking reads
+    bool   reserveReadWaiter();
+    void   releaseReadWaiter();
+
+    //bytes the queues hold in memory, against SERVER_MEMORY_LIMIT. Groups
+    //add theirs in batches, overMemoryLimit doesn't lock
+    void   addResident(int64_t bytes);
+    bool   overMemoryLimit();
+
+    //one line per queue (or just the one named) and a server total
+    std::string stats( const std::string &id );
+
+    //runs on the maintenance pool
+    void   maintainQueue( const std::string &id, boost::shared_ptr<Queue> queue );
+
     static _QueueManager* instance();
 
  private:
-    _QueueManager() : started(false){};
+    _QueueManager() : started(false), read_waiters(0), max_read_waiters(0), resident(0), memory_limit(0), over_limit(false),
+                      compact_interval(10){};
     void   run();
+    void   scheduleMaintenance();
     apache::thrift::concurrency::Mutex mutex;
 
     std::map<std::string, boost::shared_ptr<Queue> > queue_cache;
 
     bool   started;
 
+    apache::thrift::concurrency::Mutex waiter_mutex;
+    int    read_waiters;
+    int    max_read_waiters;
+
+    apache::thrift::concurrency::Mutex memory_mutex;
+    int64_t resident;
+    int64_t memory_limit;
+    volatile bool over_limit;   ///< resident >= memory_limit, set under memory_mutex
+
+    //queues are pruned on the pool, the largest logs first. A queue is
+    //never queued twice, the next run is QUEUE_COMPACT_INTERVAL (or
+    //QUEUE_COMPACT_INTERVAL_<queue>) seconds after it was queued
+    boost::shared_ptr<apache::thrift::concurrency::ThreadManager> maintenance_pool;
+    apache::thrift::concurrency::Mutex maintenance_mutex;
+    std::set<std::string>              maintaining;
+    std::map<std::string, int64_t>     next_maintenance;   ///< ms
+    int                                compact_interval;   ///< seconds
+
     static _QueueManager* pInstance;
     static apache::thrift::concurrency::Mutex _mutex;
 };
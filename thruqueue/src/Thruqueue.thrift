@@ -10,7 +10,8 @@ enum   ThruqueueExceptionCodes
         INVALID_QUEUE = 1,
         BUSY_QUEUE    = 2,
         EMPTY_QUEUE   = 3,
-        INVALID_LOCK  = 4
+        INVALID_LOCK  = 4,
+        INVALID_BATCH = 5
 }
 
 exception ThruqueueException
@@ -22,10 +23,13 @@ exception ThruqueueException
 
 struct QueueMessage
 {
-        1:string message_id,
+        1:string message_id,            #the message's seq as 16 hex digits
         2:string message
 }
 
+#Every consumer group gets every message sent to the queue, with its own
+#read position and leases. group "" is the queue's own, delete it once
+#all consumers use named groups or it keeps the whole log around
 service Thruqueue
 {
         void            ping()                                               throws(ThruqueueException e),
@@ -33,35 +37,50 @@ service Thruqueue
         void            createQueue(1:string queue_name)                     throws(ThruqueueException e),
         void            deleteQueue(1:string queue_name)                     throws(ThruqueueException e),
         void            sendMessage(1:string queue_name, 2:string msg)          throws(ThruqueueException e),
-        QueueMessage    readMessage(1:string queue_name, 2:i32 lock_time = 120) throws(ThruqueueException e),
-        void            deleteMessage(1:string queue_name, 2:string message_id) throws(ThruqueueException e),
+        QueueMessage    readMessage(1:string queue_name, 2:i32 lock_time = 120, 3:i32 wait_ms = 0, 4:string group = "") throws(ThruqueueException e),
+        void            deleteMessage(1:string queue_name, 2:string message_id, 3:string group = "") throws(ThruqueueException e),
         void            clearQueue (1:string queue_name)                        throws(ThruqueueException e),
-        i32             queueLength(1:string queue_name)                        throws(ThruqueueException e),
+
+        #batches are a single log write, readMessageList returns fewer than max (or none) when the queue runs out,
+        #and never more than the server's MAX_READ_BATCH
+        void                sendMessageList(1:string queue_name, 2:list<string> messages)                  throws(ThruqueueException e),
+        list<QueueMessage>  readMessageList(1:string queue_name, 2:i32 max, 3:i32 lock_time = 120, 4:string group = "") throws(ThruqueueException e),
+        void                deleteMessageList(1:string queue_name, 2:list<string> message_ids, 3:string group = "") throws(ThruqueueException e),
+
+        i32             queueLength(1:string queue_name, 2:string group = "")  throws(ThruqueueException e),
+
+        #new groups start with the next message sent, names are letters, digits, _ and -
+        void            createConsumerGroup(1:string queue_name, 2:string group)   throws(ThruqueueException e),
+        void            deleteConsumerGroup(1:string queue_name, 2:string group)   throws(ThruqueueException e),
+        list<string>    listConsumerGroups(1:string queue_name)                    throws(ThruqueueException e),
 
         string          admin(1:string op, 2:string data)                       throws(ThruqueueException e)
 }
 
 struct QueueOutputMessage
 {
-        1:string     message_id,
+        1:string     message_id,                #only in logs older than seq
         2:i32        timestamp        = -1,
         3:i32        lock_time        = -1,
         8:i32        last_read_chunk  = -1,
         9:i32        queue_length     = -1,
-        11:i32       chunk_pos        = -1
+        11:i32       chunk_pos        = -1,
+        12:i64       seq              = -1
 }
 
 struct QueueInputMessage
 {
-        1:string     message_id,
+        1:string     message_id,                #only in logs older than seq
         2:string     message,
         3:i32        timestamp        = -1,
         4:i32        queue_length     = -1,
-        5:i32        chunk_pos        = -1
+        5:i32        chunk_pos        = -1,
+        6:i64        seq              = -1      #position in the input log, set when read back
 }
 
 service QueueLog
 {       void log_send(1:QueueInputMessage m);
         void log_read(1:QueueOutputMessage m);
         void log_delete(1:QueueOutputMessage m);
+        void log_cursor(1:QueueOutputMessage m);
 }
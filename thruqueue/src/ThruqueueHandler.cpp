@@ -25,8 +25,7 @@ void ThruqueueHandler::deleteQueue(const std::string& queue_name)
 
 void ThruqueueHandler::listAllQueues(std::vector<std::string> &_return)
 {
-
-
+    QueueManager->listQueues(_return);
 }
 
 void ThruqueueHandler::sendMessage(const std::string& queue_name, const std::string& mess)
@@ -38,18 +37,39 @@ void ThruqueueHandler::sendMessage(const std::string& queue_name, const std::str
     queue->sendMessage(mess);
 }
 
-void ThruqueueHandler::readMessage(QueueMessage& _return, const std::string& queue_name, int32_t lock_secs)
+void ThruqueueHandler::readMessage(QueueMessage& _return, const std::string& queue_name, int32_t lock_secs, int32_t wait_ms, const std::string& group)
 {
-    shared_ptr<Queue> queue = QueueManager->getQueue(queue_name);
+    shared_ptr<ConsumerGroup> g = QueueManager->getQueue(queue_name)->getGroup(group);
+
+    _return = g->readMessage(lock_secs, wait_ms);
+}
+
+void ThruqueueHandler::deleteMessage(const std::string &queue_name, const std::string &message_id, const std::string& group)
+{
+    shared_ptr<ConsumerGroup> g = QueueManager->getQueue(queue_name)->getGroup(group);
 
-    _return = queue->readMessage(lock_secs);
+    g->deleteMessage(message_id);
 }
 
-void ThruqueueHandler::deleteMessage(const std::string &queue_name, const std::string &message_id)
+void ThruqueueHandler::sendMessageList(const std::string& queue_name, const std::vector<std::string> &messages)
 {
     shared_ptr<Queue> queue = QueueManager->getQueue(queue_name);
 
-    queue->deleteMessage(message_id);
+    queue->sendMessageList(messages);
+}
+
+void ThruqueueHandler::readMessageList(std::vector<QueueMessage> &_return, const std::string& queue_name, int32_t max, int32_t lock_secs, const std::string& group)
+{
+    shared_ptr<ConsumerGroup> g = QueueManager->getQueue(queue_name)->getGroup(group);
+
+    g->readMessageList(_return, max, lock_secs);
+}
+
+void ThruqueueHandler::deleteMessageList(const std::string &queue_name, const std::vector<std::string> &message_ids, const std::string& group)
+{
+    shared_ptr<ConsumerGroup> g = QueueManager->getQueue(queue_name)->getGroup(group);
+
+    g->deleteMessageList(message_ids);
 }
 
 void ThruqueueHandler::clearQueue(const std::string& queue_name)
@@ -61,16 +81,39 @@ void ThruqueueHandler::clearQueue(const std::string& queue_name)
 }
 
 
-int32_t ThruqueueHandler::queueLength(const std::string& queue_name)
+int32_t ThruqueueHandler::queueLength(const std::string& queue_name, const std::string& group)
+{
+    shared_ptr<ConsumerGroup> g = QueueManager->getQueue(queue_name)->getGroup(group);
+
+    return g->length();
+}
+
+void ThruqueueHandler::createConsumerGroup(const std::string& queue_name, const std::string& group)
 {
     shared_ptr<Queue> queue = QueueManager->getQueue(queue_name);
 
-    return queue->length();
+    queue->createGroup(group);
 }
 
+void ThruqueueHandler::deleteConsumerGroup(const std::string& queue_name, const std::string& group)
+{
+    shared_ptr<Queue> queue = QueueManager->getQueue(queue_name);
 
-void ThruqueueHandler::admin(std::string &_return, const std::string &op, const std::string &data)
+    queue->deleteGroup(group);
+}
+
+void ThruqueueHandler::listConsumerGroups(std::vector<std::string> &_return, const std::string& queue_name)
 {
+    shared_ptr<Queue> queue = QueueManager->getQueue(queue_name);
 
+    queue->listGroups(_return);
+}
 
+
+void ThruqueueHandler::admin(std::string &_return, const std::string &op, const std::string &data)
+{
+    if(op == "stats"){
+        _return = QueueManager->stats(data);
+        return;
+    }
 }
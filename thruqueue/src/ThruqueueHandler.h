@@ -26,13 +26,25 @@ class ThruqueueHandler : virtual public thruqueue::ThruqueueIf {
 
     void sendMessage(const std::string& queue_name, const std::string& mess);
 
-    void readMessage(thruqueue::QueueMessage& _return, const std::string& queue_name, int32_t lock_secs);
+    void readMessage(thruqueue::QueueMessage& _return, const std::string& queue_name, int32_t lock_secs, int32_t wait_ms, const std::string& group);
 
-    void deleteMessage( const std::string& queue_name, const std::string &message_id );
+    void deleteMessage( const std::string& queue_name, const std::string &message_id, const std::string& group );
 
     void clearQueue(const std::string& queue_name);
 
-    int32_t queueLength(const std::string& queue_name);
+    void sendMessageList(const std::string& queue_name, const std::vector<std::string> &messages);
+
+    void readMessageList(std::vector<thruqueue::QueueMessage> &_return, const std::string& queue_name, int32_t max, int32_t lock_secs, const std::string& group);
+
+    void deleteMessageList(const std::string& queue_name, const std::vector<std::string> &message_ids, const std::string& group);
+
+    int32_t queueLength(const std::string& queue_name, const std::string& group);
+
+    void createConsumerGroup(const std::string& queue_name, const std::string& group);
+
+    void deleteConsumerGroup(const std::string& queue_name, const std::string& group);
+
+    void listConsumerGroups(std::vector<std::string> &_return, const std::string& queue_name);
 
     void admin(std::string &_return, const std::string &op, const std::string &data);
 };
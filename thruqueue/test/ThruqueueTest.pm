@@ -0,0 +1,167 @@
+#
+# Helpers for group-test.pl, lease-test.pl and the other feature tests.
+# Each starts its own thruqueue on a scratch DOC_ROOT so it can set
+# config and restart it:
+#
+#   make && ./group-test.pl
+#
+# Set THRUQUEUE to test a binary other than ../src/thruqueue
+#
+
+package ThruqueueTest;
+
+use strict;
+use warnings;
+
+use lib './gen-perl';
+
+use Thrift;
+use Thrift::BinaryProtocol;
+use Thrift::Socket;
+use Thrift::FramedTransport;
+
+use Data::Dumper;
+use Exporter;
+use File::Temp qw(tempdir);
+use Test::More;
+use Time::HiRes qw(sleep);
+use Thruqueue::Thruqueue;
+
+our @ISA    = qw(Exporter);
+our @EXPORT = qw(run_tests start_server stop_server client connect_client scratch_dir
+                 error_code read_all);
+
+my $binary = $ENV{THRUQUEUE} || '../src/thruqueue';
+my $port   = 9193;
+
+die "$binary isn't built\n" unless -x $binary;
+
+my $root = tempdir(CLEANUP => 1);
+
+my ($server, $transport, $client);
+
+my %defaults = (
+    THREAD_COUNT     => 5,
+    SERVER_PORT      => $port,
+    DOC_ROOT         => "$root/queues",
+    MAX_READ_WAIT_MS => 2000,
+);
+
+sub scratch_dir
+{
+    return $root;
+}
+
+#any config given replaces the defaults for this run
+sub start_server
+{
+    my %conf = (%defaults, @_);
+
+    mkdir($conf{DOC_ROOT}) unless -d $conf{DOC_ROOT};
+
+    open(CONF,">$root/thruqueue.conf") || die $!;
+    print CONF "$_=$conf{$_}\n" for (sort keys %conf);
+    close(CONF);
+
+    $server = fork();
+    die $! unless defined $server;
+
+    if($server == 0){
+        exec($binary, '-f', "$root/thruqueue.conf") || die $!;
+    }
+
+    for(1..50){
+        $client = connect_client();
+
+        eval{ $client->ping(); };
+        return $client unless $@;
+
+        sleep(0.2);
+    }
+
+    die "thruqueue didn't start";
+}
+
+sub stop_server
+{
+    return unless $server;
+
+    #give the log writers time to flush
+    sleep(1);
+
+    $transport->close();
+
+    kill('TERM', $server);
+    waitpid($server, 0);
+
+    $server = undef;
+}
+
+#a connection of its own, for forked clients
+sub connect_client
+{
+    my $socket = new Thrift::Socket('localhost',$port);
+    $transport = new Thrift::FramedTransport($socket);
+
+    my $c = new Thruqueue::ThruqueueClient(new Thrift::BinaryProtocol($transport));
+
+    eval{ $transport->open() };
+
+    return $c;
+}
+
+sub client
+{
+    return $client;
+}
+
+#starts a server with the config given, runs the tests and reports
+#anything they throw
+sub run_tests
+{
+    my ($conf, $tests) = @_;
+
+    start_server(%$conf);
+
+    eval{ $tests->() };
+
+    if($@){
+        fail("unexpected error");
+        diag(Dumper($@));
+    }
+
+    stop_server();
+
+    done_testing();
+}
+
+#returns the exception code, or undef if the call didn't throw
+sub error_code
+{
+    my $sub = shift;
+
+    eval{ $sub->() };
+
+    return undef unless $@;
+
+    die $@ unless UNIVERSAL::isa($@, "Thruqueue::ThruqueueException");
+
+    return $@->{code};
+}
+
+sub read_all
+{
+    my ($queue, $group, $lock) = @_;
+
+    my @msgs;
+
+    while(1){
+        my $m;
+        last if defined error_code(sub{ $m = $client->readMessage($queue, $lock, 0, $group) });
+        push(@msgs, $m);
+    }
+
+    return @msgs;
+}
+
+1;
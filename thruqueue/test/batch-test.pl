@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+#
+# sendMessageList, readMessageList and deleteMessageList
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThruqueueTest;
+
+#small segments so batches cross them
+my %conf = (QUEUE_SEGMENT_MESSAGES => 10, MAX_READ_BATCH => 20);
+
+run_tests(\%conf, sub {
+    my $q = "test_batches";
+    client()->createQueue($q);
+
+    client()->sendMessageList($q, [map { "batch $_" } (1..25)]);
+    is(client()->queueLength($q, ""), 25, "batch sent");
+
+    is(error_code(sub{ client()->readMessageList($q, 0, 60, "") }),
+       Thruqueue::ThruqueueExceptionCodes::INVALID_BATCH, "max of 0 is refused");
+    is(error_code(sub{ client()->readMessageList($q, -1, 60, "") }),
+       Thruqueue::ThruqueueExceptionCodes::INVALID_BATCH, "so is a negative max");
+
+    my $batch = client()->readMessageList($q, 1000, 60, "");
+    is(scalar(@$batch), 20, "max is capped at MAX_READ_BATCH");
+    is_deeply([map { $_->{message} } @$batch], [map { "batch $_" } (1..20)], "in order across segments");
+
+    client()->deleteMessageList($q, [map { $_->{message_id} } @$batch], "");
+
+    $batch = client()->readMessageList($q, 20, 60, "");
+    is(scalar(@$batch), 5, "short batch when the queue runs out");
+
+    client()->deleteMessageList($q, [map { $_->{message_id} } @$batch], "");
+    is(client()->queueLength($q, ""), 0, "batch deleted");
+
+    is_deeply(client()->readMessageList($q, 5, 60, ""), [], "empty batch from an empty queue");
+
+    #a batch read leases every message in it
+    client()->sendMessageList($q, ["leased 1", "leased 2"]);
+
+    $batch = client()->readMessageList($q, 5, 1, "");
+    sleep(2);
+
+    my $again = client()->readMessageList($q, 5, 60, "");
+    is_deeply([map { $_->{message_id} } @$again], [map { $_->{message_id} } @$batch],
+              "undeleted batch comes back");
+
+    client()->deleteMessageList($q, [map { $_->{message_id} } @$again], "");
+
+    #over half a log chunk (16MB), so it goes out in several writes
+    my @big = map { sprintf("%06d", $_) . ("x" x (100*1024)) } (1..100);
+    client()->sendMessageList($q, \@big);
+
+    my @got;
+
+    while(@got < @big){
+        $batch = client()->readMessageList($q, 20, 60, "");
+        last unless @$batch;
+
+        push(@got, map { $_->{message} } @$batch);
+    }
+
+    is(scalar(@got), 100, "big batch read back");
+    ok(!grep({ $got[$_] ne $big[$_] } (0..$#got)), "bodies intact and in order");
+});
@@ -0,0 +1,137 @@
+#!/usr/bin/perl
+
+#
+# Producers and consumers on their own connections at once, across
+# segment rolls: every message is delivered once, under its own id
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use POSIX qw(_exit);
+use Test::More;
+use ThruqueueTest;
+
+my $producers = 3;
+my $consumers = 3;
+my $per       = 300;
+
+my $q    = "test_concurrency";
+my $done = scratch_dir()."/producers_done";
+
+sub child
+{
+    my $sub = shift;
+
+    my $pid = fork();
+    die $! unless defined $pid;
+
+    return $pid if $pid;
+
+    my $ok = eval{ $sub->(connect_client()); 1 };
+    _exit($ok ? 0 : 1);
+}
+
+sub produce
+{
+    my ($c, $p) = @_;
+
+    my $i = 1;
+
+    #singles and batches mixed
+    while($i <= $per){
+        if($i % 3){
+            $c->sendMessage($q, "$p:$i");
+            $i++;
+        } else {
+            my $last = $i + 9 > $per ? $per : $i + 9;
+            $c->sendMessageList($q, [map { "$p:$_" } ($i..$last)]);
+            $i = $last + 1;
+        }
+    }
+}
+
+sub consume
+{
+    my ($c, $n) = @_;
+
+    open(OUT, ">".scratch_dir()."/consumer.$n") || die $!;
+
+    my $empty = 0;
+
+    while(!-e $done || $empty < 3){
+        my $m;
+
+        eval{ $m = $c->readMessage($q, 60, 200, "") };
+
+        if($@){
+            die $@ unless UNIVERSAL::isa($@, "Thruqueue::ThruqueueException");
+            $empty++;
+            next;
+        }
+
+        $empty = 0;
+
+        $c->deleteMessage($q, $m->{message_id}, "");
+        print OUT "$m->{message_id} $m->{message}\n";
+    }
+
+    close(OUT);
+}
+
+#enough workers for every client to have one
+run_tests({THREAD_COUNT => 8, QUEUE_SEGMENT_MESSAGES => 50, QUEUE_COMPACT_INTERVAL => 1}, sub {
+    client()->createQueue($q);
+
+    my @c = map { my $n = $_; child(sub { consume($_[0], $n) }) } (1..$consumers);
+    my @p = map { my $n = $_; child(sub { produce($_[0], $n) }) } (1..$producers);
+
+    my $failed = 0;
+
+    foreach my $pid (@p){
+        waitpid($pid, 0);
+        $failed++ if $?;
+    }
+
+    open(DONE, ">$done") && close(DONE);
+
+    foreach my $pid (@c){
+        waitpid($pid, 0);
+        $failed++ if $?;
+    }
+
+    is($failed, 0, "every client finished cleanly");
+
+    my (%ids, %bodies);
+    my $in_order = 1;
+
+    foreach my $n (1..$consumers){
+        my %last;
+
+        open(IN, "<".scratch_dir()."/consumer.$n") || die $!;
+
+        while(my $line = <IN>){
+            chomp($line);
+            my ($id, $body) = split(/ /, $line);
+            my ($p, $i)     = split(/:/, $body);
+
+            $ids{$id}++;
+            $bodies{$body}++;
+
+            #each consumer sees a producer's messages in send order
+            $in_order = 0 if defined $last{$p} && $i <= $last{$p};
+            $last{$p} = $i;
+        }
+
+        close(IN);
+    }
+
+    is(scalar(keys %bodies), $producers * $per, "every message delivered");
+    ok(!grep({ $_ > 1 } values %bodies), "none twice");
+    is(scalar(keys %ids), $producers * $per, "each under its own id");
+    ok($in_order, "in send order per producer");
+
+    is(client()->queueLength($q, ""), 0, "queue drained");
+});
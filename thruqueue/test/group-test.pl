@@ -0,0 +1,82 @@
+#!/usr/bin/perl
+
+#
+# Consumer groups each read every message, on their own cursor
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThruqueueTest;
+
+my %conf = (QUEUE_SEGMENT_MESSAGES => 10, QUEUE_COMPACT_INTERVAL => 1);
+
+run_tests(\%conf, sub {
+    my $q = "test_groups";
+    client()->createQueue($q);
+
+    client()->createConsumerGroup($q, "a");
+    client()->createConsumerGroup($q, "b");
+    is_deeply([sort @{client()->listConsumerGroups($q)}], ["","a","b"], "groups listed");
+
+    is(error_code(sub{ client()->createConsumerGroup($q, "bad/name") }),
+       Thruqueue::ThruqueueExceptionCodes::INVALID_QUEUE, "bad group names are refused");
+
+    client()->sendMessageList($q, [map { "fanout $_" } (1..15)]);
+
+    foreach my $g ("a","b"){
+        my @got = read_all($q, $g, 60);
+        is(scalar(@got), 15, "group $g gets every message");
+        is($got[14]->{message}, "fanout 15", "group $g in order");
+
+        client()->deleteMessageList($q, [map { $_->{message_id} } @got], $g);
+        is(client()->queueLength($q, $g), 0, "group $g drained");
+    }
+
+    is(client()->queueLength($q, ""), 15, "unnamed group untouched");
+
+    #a group created later only sees what's sent after it
+    client()->createConsumerGroup($q, "late");
+    client()->sendMessage($q, "after late");
+
+    my @late = read_all($q, "late", 60);
+    is_deeply([map { $_->{message} } @late], ["after late"], "new groups start with the next message");
+
+    client()->deleteConsumerGroup($q, "");
+    ok(defined error_code(sub{ client()->queueLength($q, "") }), "unnamed group deleted");
+
+    client()->deleteConsumerGroup($q, "a");
+    is_deeply([sort @{client()->listConsumerGroups($q)}], ["b","late"], "named group deleted");
+
+    #groups, their cursors and leases survive a restart
+    $q = "test_group_recovery";
+    client()->createQueue($q);
+    client()->createConsumerGroup($q, "g");
+
+    client()->sendMessageList($q, ["one", "two", "three"]);
+
+    my $held = client()->readMessage($q, 600, 0, "g");
+    client()->readMessage($q, 600, 0, "");
+
+    stop_server();
+    start_server(%conf);
+
+    client()->createQueue($q);
+
+    is_deeply([sort @{client()->listConsumerGroups($q)}], ["","g"], "groups recovered");
+    is(client()->queueLength($q, "g"), 2, "group g kept its own place");
+    is(client()->queueLength($q, ""), 2, "and so did the unnamed group");
+
+    is(client()->readMessage($q, 600, 0, "g")->{message}, "two", "reading on from the cursor");
+
+    client()->deleteMessage($q, $held->{message_id}, "g");
+
+    #clearing empties every group
+    client()->clearQueue($q);
+
+    is(client()->queueLength($q, ""), 0, "cleared");
+    is(client()->queueLength($q, "g"), 0, "every group cleared");
+});
@@ -0,0 +1,69 @@
+#!/usr/bin/perl
+
+#
+# Message ids are seqs as 16 hex digits, never reused
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThruqueueTest;
+
+run_tests({}, sub {
+    my $q = "test_ids";
+    client()->createQueue($q);
+
+    client()->sendMessage($q, "message $_") for (1..3);
+    is(client()->queueLength($q, ""), 3, "three sent");
+
+    my @msgs = read_all($q, "", 60);
+    is_deeply([map { $_->{message} } @msgs], ["message 1","message 2","message 3"], "read in order");
+
+    like($_->{message_id}, qr/^[0-9a-f]{16}$/, "id is a hex seq") for @msgs;
+    is(hex($msgs[1]->{message_id}), hex($msgs[0]->{message_id}) + 1, "one apart");
+    is(hex($msgs[2]->{message_id}), hex($msgs[1]->{message_id}) + 1, "in send order");
+
+    client()->deleteMessage($q, $msgs[1]->{message_id}, "");
+    is(error_code(sub{ client()->deleteMessage($q, $msgs[1]->{message_id}, "") }), undef,
+       "deleting twice is ignored");
+
+    foreach my $bad ("not an id", "", "ffffffffffffffff", "0000000000000001x"){
+        is(error_code(sub{ client()->deleteMessage($q, $bad, "") }), undef, "'$bad' is ignored");
+    }
+
+    client()->deleteMessageList($q, [$msgs[0]->{message_id}, "junk", $msgs[2]->{message_id}], "");
+
+    is(client()->queueLength($q, ""), 0, "all deleted");
+    is(error_code(sub{ client()->readMessage($q, 60, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "nothing comes back");
+
+    #seqs keep counting across clearQueue and restarts
+    client()->sendMessage($q, "before clear");
+    my $before = client()->readMessage($q, 60, 0, "");
+
+    client()->clearQueue($q);
+    is(client()->queueLength($q, ""), 0, "cleared");
+
+    client()->sendMessage($q, "after clear");
+    my $after = client()->readMessage($q, 60, 0, "");
+
+    is($after->{message}, "after clear", "usable after clear");
+    ok($after->{message_id} gt $before->{message_id}, "ids keep increasing across clear");
+
+    is(error_code(sub{ client()->deleteMessage($q, $before->{message_id}, "") }), undef,
+       "ids from before the clear are ignored");
+
+    client()->deleteMessage($q, $after->{message_id}, "");
+
+    stop_server();
+    start_server();
+
+    client()->createQueue($q);
+    client()->sendMessage($q, "after restart");
+
+    my $restarted = client()->readMessage($q, 60, 0, "");
+    ok($restarted->{message_id} gt $after->{message_id}, "and across restarts");
+});
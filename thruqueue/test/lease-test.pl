@@ -0,0 +1,89 @@
+#!/usr/bin/perl
+
+#
+# Read locks are leases: an undeleted message comes back once its
+# lock_time runs out, across restarts too
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use Time::HiRes qw(gettimeofday sleep);
+use ThruqueueTest;
+
+run_tests({}, sub {
+    my $q = "test_leases";
+    client()->createQueue($q);
+
+    client()->sendMessage($q, "leased");
+
+    my $first = client()->readMessage($q, 1, 0, "");
+    is(error_code(sub{ client()->readMessage($q, 1, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "leased message is hidden");
+    is(client()->queueLength($q, ""), 0, "and not counted");
+
+    sleep(1.5);
+
+    is(client()->queueLength($q, ""), 1, "counted again once the lease runs out");
+
+    my $again = client()->readMessage($q, 60, 0, "");
+    is($again->{message_id}, $first->{message_id}, "redelivered with the same id");
+    is($again->{message}, "leased", "and the same body");
+
+    client()->deleteMessage($q, $again->{message_id}, "");
+    sleep(1.5);
+    is(client()->queueLength($q, ""), 0, "deleted lease doesn't come back");
+
+    #redeliveries go ahead of newer messages
+    client()->sendMessageList($q, ["older", "newer"]);
+
+    my $older = client()->readMessage($q, 1, 0, "");
+    sleep(1.5);
+
+    is(client()->readMessage($q, 60, 0, "")->{message_id}, $older->{message_id}, "expired lease first");
+    is(client()->readMessage($q, 60, 0, "")->{message}, "newer", "then the rest");
+
+    client()->sendMessage($q, "no lease");
+    client()->readMessage($q, 0, 0, "");
+    sleep(1.5);
+    is(client()->queueLength($q, ""), 0, "lock_time 0 consumes the message");
+
+    is(error_code(sub{ client()->readMessage($q, 5*60*60, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::INVALID_LOCK, "locks over 4 hours are refused");
+    is(error_code(sub{ client()->readMessage($q, -1, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::INVALID_LOCK, "so are negative ones");
+
+    #leases are kept in the journal
+    $q = "test_lease_recovery";
+    client()->createQueue($q);
+
+    client()->sendMessageList($q, ["long lease", "short lease", "unread"]);
+
+    my $long      = client()->readMessage($q, 600, 0, "");
+    my $short     = client()->readMessage($q, 4, 0, "");
+    my $leased_at = gettimeofday();
+
+    stop_server();
+    start_server();
+
+    client()->createQueue($q);
+
+    is(client()->queueLength($q, ""), 1, "only the unread message is queued");
+    is(client()->readMessage($q, 600, 0, "")->{message}, "unread", "cursor recovered");
+
+    #the short lease runs out while the server is back up
+    sleep($leased_at + 4.5 - gettimeofday());
+
+    my $redelivered = client()->readMessage($q, 600, 0, "");
+    is($redelivered->{message_id}, $short->{message_id}, "short lease expired after restart");
+    is($redelivered->{message}, "short lease", "with its body");
+
+    is(error_code(sub{ client()->readMessage($q, 600, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "long lease still held");
+
+    client()->deleteMessage($q, $long->{message_id}, "");
+    client()->deleteMessage($q, $redelivered->{message_id}, "");
+});
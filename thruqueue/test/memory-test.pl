@@ -0,0 +1,64 @@
+#!/usr/bin/perl
+
+#
+# Past QUEUE_MEMORY_LIMIT (or SERVER_MEMORY_LIMIT) groups buffer one
+# message at a time and leases drop their bodies, which are read back
+# from the log if the lease runs out
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use Time::HiRes qw(sleep);
+use ThruqueueTest;
+
+my @bodies = map { sprintf("%04d", $_) . ("m" x 1000) } (1..50);
+
+sub stat_of
+{
+    my ($name, $queue) = @_;
+
+    return client()->admin("stats", $queue) =~ /\b$name=(\d+)/ ? $1 : undef;
+}
+
+#reads everything with short leases, then reads the redeliveries back
+sub spill_and_reload
+{
+    my ($q, $what) = @_;
+
+    client()->createQueue($q);
+    client()->sendMessageList($q, \@bodies);
+
+    my @first = read_all($q, "", 1);
+    is(scalar(@first), 50, "$what: every message read");
+    ok(!grep({ $first[$_]->{message} ne $bodies[$_] } (0..49)), "$what: with its body");
+
+    ok(stat_of("spilled", $q) > 0, "$what: leases past the limit dropped their bodies");
+
+    sleep(1.5);
+
+    my @again = read_all($q, "", 600);
+    is(scalar(@again), 50, "$what: every lease ran out");
+    is_deeply([sort map { $_->{message} } @again], [sort @bodies], "$what: bodies read back from the log");
+
+    client()->deleteMessageList($q, [map { $_->{message_id} } @again], "");
+    is(stat_of("leased", $q), 0, "$what: all deleted");
+}
+
+run_tests({QUEUE_MEMORY_LIMIT => 20000}, sub {
+    spill_and_reload("test_queue_limit", "QUEUE_MEMORY_LIMIT");
+
+    is(stat_of("memory_limit", "test_queue_limit"), 20000, "limit in stats");
+    ok(stat_of("resident_bytes", "test_queue_limit") < 20000, "nothing held once deleted");
+
+    #the server wide limit does the same for every queue
+    stop_server();
+    start_server(SERVER_MEMORY_LIMIT => 20000);
+
+    spill_and_reload("test_server_limit", "SERVER_MEMORY_LIMIT");
+
+    like(client()->admin("stats", ""), qr/^server: resident_bytes=\d+,memory_limit=20000$/m, "server total in stats");
+});
@@ -0,0 +1,37 @@
+#!/usr/bin/perl
+
+#
+# Messages come out in the order they were sent, across buffer refills
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThruqueueTest;
+
+#a small buffer so every few reads refill it
+run_tests({QUEUE_BUFFER_SIZE => 5}, sub {
+    my $q = "test_order";
+    client()->createQueue($q);
+
+    client()->sendMessage($q, "message $_") for (1..23);
+
+    my @got = map { $_->{message} } read_all($q, "", 0);
+    is_deeply(\@got, [map { "message $_" } (1..23)], "FIFO across refills");
+
+    #sends landing between reads, with part of a batch still buffered
+    client()->sendMessage($q, "message $_") for (1..7);
+
+    @got = ();
+    push(@got, client()->readMessage($q, 0, 0, "")->{message}) for (1..3);
+
+    client()->sendMessage($q, "message $_") for (8..12);
+
+    push(@got, map { $_->{message} } read_all($q, "", 0));
+    is_deeply(\@got, [map { "message $_" } (1..12)], "FIFO with sends in between");
+
+    is(client()->queueLength($q, ""), 0, "nothing left over");
+});
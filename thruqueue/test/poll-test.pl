@@ -0,0 +1,89 @@
+#!/usr/bin/perl
+
+#
+# readMessage with wait_ms blocks on an empty queue until a message is
+# sent, a lease runs out or the wait is over
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use POSIX qw(_exit);
+use Test::More;
+use Time::HiRes qw(gettimeofday sleep);
+use ThruqueueTest;
+
+#runs the sub in a child with its own connection after a delay
+sub later
+{
+    my ($delay, $sub) = @_;
+
+    my $pid = fork();
+    die $! unless defined $pid;
+
+    return $pid if $pid;
+
+    sleep($delay);
+
+    eval{ $sub->(connect_client()) };
+    _exit(0);
+}
+
+my %conf = (MAX_READ_WAIT_MS => 3000, MAX_READ_WAITERS => 1);
+
+run_tests(\%conf, sub {
+    my $q = "test_poll";
+    client()->createQueue($q);
+
+    my $t0 = gettimeofday();
+    is(error_code(sub{ client()->readMessage($q, 60, 500, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "times out on an empty queue");
+    ok(gettimeofday() - $t0 >= 0.4, "after waiting");
+
+    $t0 = gettimeofday();
+    is(error_code(sub{ client()->readMessage($q, 60, 10000, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "long waits time out too");
+    my $waited = gettimeofday() - $t0;
+    ok($waited >= 2.5 && $waited < 4, "capped at MAX_READ_WAIT_MS");
+
+    $t0 = gettimeofday();
+    is(error_code(sub{ client()->readMessage($q, 60, 0, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "wait_ms 0 doesn't block");
+    ok(gettimeofday() - $t0 < 0.2, "returns straight away");
+
+    #a send wakes the reader
+    my $pid = later(0.3, sub { $_[0]->sendMessage($q, "wake up") });
+
+    $t0 = gettimeofday();
+    my $m = client()->readMessage($q, 60, 1000, "");
+    $waited = gettimeofday() - $t0;
+    waitpid($pid, 0);
+
+    is($m->{message}, "wake up", "woken by a send");
+    ok($waited >= 0.2 && $waited < 0.9, "without waiting out the timeout");
+
+    #so does a lease running out
+    client()->sendMessage($q, "leased");
+    my $leased = client()->readMessage($q, 1, 0, "");
+
+    $t0 = gettimeofday();
+    $m  = client()->readMessage($q, 60, 3000, "");
+    is($m->{message_id}, $leased->{message_id}, "woken when a lease runs out");
+    ok(gettimeofday() - $t0 < 2, "not at the end of the wait");
+
+    #past MAX_READ_WAITERS reads don't block
+    my $other = "test_poll_waiters";
+    client()->createQueue($other);
+
+    $pid = later(0, sub { eval{ $_[0]->readMessage($other, 60, 1000, "") } });
+    sleep(0.3);
+
+    $t0 = gettimeofday();
+    is(error_code(sub{ client()->readMessage($other, 60, 1000, "") }),
+       Thruqueue::ThruqueueExceptionCodes::EMPTY_QUEUE, "second waiter is turned away");
+    ok(gettimeofday() - $t0 < 0.5, "without blocking");
+
+    waitpid($pid, 0);
+});
@@ -0,0 +1,70 @@
+#!/usr/bin/perl
+
+#
+# Input logs are split into segments, background compaction unlinks the
+# ones every group is done with and rewrites long journals
+#
+
+use strict;
+use warnings;
+
+use lib '.';
+
+use Test::More;
+use ThruqueueTest;
+
+my %conf = (QUEUE_SEGMENT_MESSAGES => 10, QUEUE_JOURNAL_RECORDS => 20, QUEUE_COMPACT_INTERVAL => 1);
+
+my $q    = "test_segments";
+my $root = scratch_dir()."/queues";
+
+sub segments
+{
+    return [sort { $a <=> $b } map { /_input\.(\d+)\.log$/ ? $1 : () } glob("$root/${q}_input.*.log")];
+}
+
+sub journals
+{
+    return scalar(() = glob("$root/${q}_output.*.log"));
+}
+
+run_tests(\%conf, sub {
+    client()->createQueue($q);
+
+    client()->sendMessage($q, "message $_") for (1..35);
+    is_deeply(segments(), [0,10,20,30], "a segment per 10 messages");
+
+    my @msgs = read_all($q, "", 600);
+    is(scalar(@msgs), 35, "read across every segment");
+
+    client()->deleteMessage($q, $_->{message_id}, "") for (@msgs[0..24]);
+
+    #the first lease left is seq 25, in the segment starting at 20
+    sleep(3);
+
+    is_deeply(segments(), [20,30], "consumed segments unlinked");
+    is(journals(), 1, "long journal rewritten and the old one unlinked");
+
+    like(client()->admin("stats", $q), qr/segments=2/, "stats agree");
+
+    #compaction kept the cursor and the leases
+    stop_server();
+    start_server(%conf);
+
+    client()->createQueue($q);
+
+    is(client()->queueLength($q, ""), 0, "nothing unread after a restart");
+
+    client()->sendMessage($q, "after restart");
+
+    my $m = client()->readMessage($q, 600, 0, "");
+    is($m->{message}, "after restart", "new sends carry on");
+    ok($m->{message_id} gt $msgs[34]->{message_id}, "after the old seqs");
+
+    client()->deleteMessage($q, $_->{message_id}, "") for (@msgs[25..34], $m);
+
+    sleep(3);
+
+    is(scalar(@{segments()}), 1, "only the segment being written is left");
+    is(client()->queueLength($q, ""), 0, "and the queue is empty");
+});
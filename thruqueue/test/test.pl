@@ -1,55 +1,40 @@
 #!/usr/bin/perl
 
+#
+# Times sending, reading and deleting messages one at a time:
+#
+#   make && ./test.pl [messages]
+#
+# The *-test.pl scripts check the features
+#
+
 use strict;
 use warnings;
 
-use lib './gen-perl';
-
-use Thrift;
-use Thrift::BinaryProtocol;
-use Thrift::Socket;
-use Thrift::FramedTransport;
+use lib '.';
 
-use Data::Dumper;
+use Test::More;
 use Time::HiRes qw(gettimeofday);
-use Thruqueue::Thruqueue;
-
-my $socket    = new Thrift::Socket('localhost',9093);
-my $transport = new Thrift::FramedTransport($socket);
-my $protocol  = new Thrift::BinaryProtocol($transport);
-my $client    = new Thruqueue::ThruqueueClient($protocol);
+use ThruqueueTest;
 
 my $count = shift || 100;
 
-my $t0 = gettimeofday();
-
-$transport->open();
-
-warn "connected";
-
-my $queue_name = "test_queue";
+run_tests({}, sub {
+    my $q = "test_timing";
+    client()->createQueue($q);
 
-eval{
-
-    $client->createQueue($queue_name);
-    warn "created";
-
-    foreach my $i (1..$count){
-
-        #$client->sendMessage($queue_name,"message $i"x800);
-    }
+    my $t0 = gettimeofday();
 
-    $client->queueLength($queue_name);
+    client()->sendMessage($q, "message $_") for (1..$count);
 
     foreach my $i (1..$count){
-        $client->readMessage($queue_name,10);
-        $client->deleteMessage($queue_name);
+        my $m = client()->readMessage($q, 10, 0, "");
+        client()->deleteMessage($q, $m->{message_id}, "");
     }
 
     my $t1 = gettimeofday();
 
-    print "Added $count docs in ".sprintf("%0.2f",($t1-$t0))."Secs\n";
+    is(client()->queueLength($q, ""), 0, "every message read and deleted");
 
-}; if($@){
-    warn(Dumper($@));
-}
+    diag("Sent, read and deleted $count messages in ".sprintf("%0.2f",($t1-$t0))." Secs");
+});